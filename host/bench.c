@@ -0,0 +1,484 @@
+#include <pebble.h>
+#include <stdio.h>
+#include <math.h>
+#include "shim.h"
+#include "common.h"
+#include "canvas.h"
+#include "raster.h"
+#include "stamps.h"
+#include "intmath.h"
+#include "filter.h"
+#include "pbm.h"
+
+// Drawing and integer math benchmarks for the host build (build/host/draw-bench).
+// Draws a fixed set of synthetic strokes with every pen and eraser width, reporting the time per
+// segment and the image bytes changed per stroke. Images can be saved as PBM files (--write DIR)
+// and later compared byte-for-byte with the saved files (--check DIR), so a change to the drawing
+// code can be timed and checked for any difference in what it draws. The reference images are kept
+// in host/golden, so run with --check host/golden after changing the drawing code. The fixed-point
+// math is also checked against exact (double) versions, failing if its error is out of bounds.
+//
+// Usage: draw-bench [--write DIR | --check DIR] [--filter TEXT]
+
+#define MAX_STROKES 64
+#define MAX_POINTS 256
+#define MIN_BENCH_NS 20000000  // Repeat each case for at least 20 ms
+#define MATH_CALLS 1000000
+
+typedef struct {
+  const char *name;
+  int count;
+  int lengths[MAX_STROKES];
+  GPoint points[MAX_STROKES][MAX_POINTS];
+} Corpus;
+
+typedef enum {
+  BRUSH_PEN,
+  BRUSH_ERASER_SQUARE,
+  BRUSH_ERASER_ROUND
+} Brush;
+
+static const char *s_brush_names[] = { "pen", "eraser-square", "eraser-round" };
+
+static Corpus s_corpora[3];
+static const char *s_write_dir = NULL;
+static const char *s_check_dir = NULL;
+static const char *s_filter = NULL;
+static int s_failures = 0;
+static int s_inaccurate = 0;  // Accuracy checks that were out of bounds
+static volatile uint32_t s_sink;  // Keeps results of timed math calls from being optimized away
+
+// Deterministic pseudo random numbers, so the corpus is the same on every machine
+static uint32_t s_seed;
+
+static int next_random(int range) {
+  s_seed = (s_seed * 1103515245) + 12345;
+  return (int)((s_seed >> 8) % (uint32_t)range);
+}
+
+static int16_t clamp_coord(int value, int max) {
+  return (value < 0) ? 0 : (value >= max) ? (max - 1) : value;
+}
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((uint64_t)ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+// Short moves of a pixel or two around a point, like drawing slowly (most canvas segments)
+static void make_jitter(Corpus *corpus) {
+  corpus->name = "jitter";
+  corpus->count = MAX_STROKES;
+  s_seed = 1;
+  for (int s = 0; s < corpus->count; s++) {
+    GPoint p = GPoint(next_random(IMG_WIDTH), next_random(IMG_HEIGHT));
+    corpus->lengths[s] = MAX_POINTS;
+    for (int i = 0; i < MAX_POINTS; i++) {
+      p.x = clamp_coord(p.x + next_random(5) - 2, IMG_WIDTH);
+      p.y = clamp_coord(p.y + next_random(5) - 2, IMG_HEIGHT);
+      corpus->points[s][i] = p;
+    }
+  }
+}
+
+// Long straight segments corner to corner and across the screen at random angles
+static void make_diagonals(Corpus *corpus) {
+  corpus->name = "diagonal";
+  corpus->count = MAX_STROKES;
+  s_seed = 2;
+  for (int s = 0; s < corpus->count; s++) {
+    corpus->lengths[s] = 2;
+    if (s < 2) {
+      corpus->points[s][0] = GPoint(0, (s == 0) ? 0 : IMG_HEIGHT - 1);
+      corpus->points[s][1] = GPoint(IMG_WIDTH - 1, (s == 0) ? IMG_HEIGHT - 1 : 0);
+    } else {
+      corpus->points[s][0] = GPoint(next_random(IMG_WIDTH / 4), next_random(IMG_HEIGHT));
+      corpus->points[s][1] = GPoint(IMG_WIDTH - 1 - next_random(IMG_WIDTH / 4), next_random(IMG_HEIGHT));
+    }
+  }
+}
+
+// Back and forth sweeps over the whole screen in steps of a few pixels, like fast drawing
+static void make_sweeps(Corpus *corpus) {
+  corpus->name = "sweep";
+  corpus->count = 8;
+  s_seed = 3;
+  for (int s = 0; s < corpus->count; s++) {
+    int n = 0;
+    int step = 3 + s;
+    for (int y = s; y < IMG_HEIGHT && n + 2 <= MAX_POINTS; y += 12) {
+      for (int x = 0; x < IMG_WIDTH && n < MAX_POINTS; x += step)
+        corpus->points[s][n++] = GPoint(((y / 12) % 2) ? (IMG_WIDTH - 1 - x) : x, y);
+    }
+    corpus->lengths[s] = n;
+  }
+}
+
+// Draw a segment the same way the canvas does
+static void draw_segment(uint8_t *image, Brush brush, int width, GPoint from, GPoint to) {
+  switch (brush) {
+    case BRUSH_PEN:
+      if (abs(to.x - from.x) > 1 || abs(to.y - from.y) > 1)
+        raster_draw_capsule(image, from, to, width / 2, GColorBlack);
+      else
+        raster_stamp(image, get_round_stamp(width), to, GColorBlack);
+      break;
+    case BRUSH_ERASER_SQUARE:
+      raster_stamp(image, get_square_stamp(width), to, GColorWhite);
+      break;
+    case BRUSH_ERASER_ROUND:
+      raster_stamp(image, get_round_stamp(width), to, GColorWhite);
+      break;
+  }
+}
+
+// Draw every stroke of a corpus, returning the number of segments drawn
+static int draw_corpus(uint8_t *image, const Corpus *corpus, Brush brush, int width) {
+  int segments = 0;
+  for (int s = 0; s < corpus->count; s++) {
+    GPoint last = corpus->points[s][0];
+    for (int i = 0; i < corpus->lengths[s]; i++) {
+      draw_segment(image, brush, width, last, corpus->points[s][i]);
+      last = corpus->points[s][i];
+      segments++;
+    }
+  }
+  return segments;
+}
+
+// Start image: white for the pen and black for the eraser, so every segment changes something
+static void reset_image_data(uint8_t *image, Brush brush) {
+  memset(image, (brush == BRUSH_PEN) ? 0xFF : 0x00, IMG_PIXELS);
+}
+
+// Whether two images have the same pixels (the padding at the end of each row is ignored)
+static bool same_pixels(const uint8_t *a, const uint8_t *b) {
+  for (int y = 0; y < IMG_HEIGHT; y++) {
+    if (memcmp(&a[y * IMG_ROW_BYTES], &b[y * IMG_ROW_BYTES], IMG_WIDTH / 8) != 0) return false;
+  }
+  return true;
+}
+
+// Save the image or compare it with the saved one, depending on the options
+static const char *check_image(const char *name, const uint8_t *image) {
+  static uint8_t saved[IMG_PIXELS];
+  char path[512];
+
+  if (s_write_dir == NULL && s_check_dir == NULL) return "";
+
+  snprintf(path, sizeof(path), "%s/%s.pbm", (s_write_dir != NULL) ? s_write_dir : s_check_dir, name);
+
+  if (s_write_dir != NULL) {
+    if (pbm_write(path, image)) return "written";
+    s_failures++;
+    return "write failed";
+  }
+
+  if (pbm_read(path, saved) && same_pixels(saved, image)) return "same";
+  s_failures++;
+  return "DIFFERENT";
+}
+
+static bool is_selected(const char *name) {
+  return s_filter == NULL || strstr(name, s_filter) != NULL;
+}
+
+// Time drawing a corpus with a brush, then check what it drew
+static void bench_raster(const Corpus *corpus, Brush brush, int width) {
+  static uint8_t image[IMG_PIXELS];
+  static uint8_t before[IMG_PIXELS];
+  char name[64];
+
+  snprintf(name, sizeof(name), "%s-%s-%d", corpus->name, s_brush_names[brush], width);
+  if (!is_selected(name)) return;
+
+  // Bytes changed by each stroke (drawn on its own, untimed)
+  uint64_t changed = 0;
+  for (int s = 0; s < corpus->count; s++) {
+    reset_image_data(image, brush);
+    memcpy(before, image, IMG_PIXELS);
+    Corpus single = { corpus->name, 1, { corpus->lengths[s] } };
+    memcpy(single.points[0], corpus->points[s], corpus->lengths[s] * sizeof(GPoint));
+    draw_corpus(image, &single, brush, width);
+    for (int i = 0; i < IMG_PIXELS; i++) changed += (image[i] != before[i]);
+  }
+
+  // Time drawing the whole corpus (repeated over the same image)
+  uint64_t segments = 0;
+  uint64_t start = now_ns();
+  uint64_t elapsed;
+  reset_image_data(image, brush);
+  do {
+    segments += draw_corpus(image, corpus, brush, width);
+    elapsed = now_ns() - start;
+  } while (elapsed < MIN_BENCH_NS);
+
+  printf("%-28s %9.1f ns/segment %8.1f bytes/stroke  %s\n", name, (double)elapsed / segments,
+         (double)changed / corpus->count, check_image(name, image));
+}
+
+// Time drawing a corpus through the canvas: moving the cursor and redrawing the window for each
+// point, including copying the changed area to the framebuffer
+static void bench_canvas(const Corpus *corpus, int width) {
+  char name[64];
+
+  snprintf(name, sizeof(name), "%s-canvas-pen-%d", corpus->name, width);
+  if (!is_selected(name)) return;
+
+  uint64_t segments = 0;
+  uint64_t frame_bytes = 0;
+  uint64_t elapsed = 0;
+
+  do {
+    shim_reset();
+    show_canvas(NULL, NULL);
+    set_penwith(width);
+    shim_redraw();
+
+    uint64_t start = now_ns();
+    for (int s = 0; s < corpus->count; s++) {
+      cursor_set_loc(corpus->points[s][0]);
+      shim_redraw();
+      toggle_pen();
+      for (int i = 0; i < corpus->lengths[s]; i++) {
+        cursor_set_loc(corpus->points[s][i]);
+        shim_redraw();
+        frame_bytes += get_frame_bytes();
+        segments++;
+      }
+      toggle_pen();
+      shim_redraw();
+    }
+    elapsed += now_ns() - start;
+
+    if (elapsed >= MIN_BENCH_NS) break;
+    hide_canvas();
+  } while (true);
+
+  printf("%-28s %9.1f ns/segment %8.1f bytes/frame   %s\n", name, (double)elapsed / segments,
+         (double)frame_bytes / segments, check_image(name, get_imagedata()));
+  hide_canvas();
+}
+
+// Time a math function over a range of inputs
+#define BENCH_MATH(label, expr) do { \
+    uint64_t start = now_ns(); \
+    uint32_t sum = 0; \
+    for (uint32_t i = 0; i < MATH_CALLS; i++) sum += (uint32_t)(expr); \
+    s_sink = sum; \
+    printf("%-28s %9.2f ns/call\n", label, (double)(now_ns() - start) / MATH_CALLS); \
+  } while (0)
+
+static void bench_math(void) {
+  if (!is_selected("math")) return;
+
+  uint16_t angle_x, angle_y;
+  AxisFilter filter;
+
+  BENCH_MATH("math-intsqrt", intsqrt(i * 4093));
+  BENCH_MATH("math-intsqrt_floor", intsqrt_floor(i * 4093));
+  BENCH_MATH("math-intrsqrt", intrsqrt(i + 1));
+  BENCH_MATH("math-intatan2", intatan2((int32_t)(i % 2001) - 1000, (int32_t)((i * 7) % 2001) - 1000));
+  BENCH_MATH("math-tilt_to_angles", (tilt_to_angles((i % 2001) - 1000, ((i * 7) % 2001) - 1000, -800,
+                                                    &angle_x, &angle_y), angle_x + angle_y));
+  BENCH_MATH("math-tilt_to_cursor", tilt_to_cursor((i % 801) - 400, ((i * 7) % 801) - 400, -900, 0, 0,
+                                                   UINT16_MAX / 10, GSize(IMG_WIDTH, IMG_HEIGHT)).x);
+
+  filter_configure(FILTER_FIXED, 900, 100);
+  filter_reset(&filter, 0);
+  BENCH_MATH("math-filter_update-fixed", filter_update(&filter, (int32_t)(i % 2001) - 1000));
+  filter_configure(FILTER_ADAPTIVE, 900, 100);
+  filter_reset(&filter, 0);
+  BENCH_MATH("math-filter_update-adaptive", filter_update(&filter, (int32_t)(i % 2001) - 1000));
+}
+
+// Synthetic accelerometer input for one axis: the wrist held still (with sensor jitter), tilted
+// slowly, and flicked quickly to a new angle, within the +/-4g range of the watch
+#define ACCEL_SAMPLES 20000
+#define FILTER_PERIOD_MS 100
+#define FILTER_TIME_CONSTANT_MS 900
+
+static void make_accel(int32_t *samples, int count) {
+  int target = 0;
+  int value = 0;
+  s_seed = 7;
+  for (int i = 0; i < count; i++) {
+    switch (next_random(40)) {
+      case 0: target = next_random(2001) - 1000; break;             // Quick flick
+      case 1: case 2: target += next_random(201) - 100; break;      // Slow tilt
+    }
+    value += (target - value) / 4;
+    int sample = value + next_random(41) - 20;                      // Jitter
+    samples[i] = (sample < -4000) ? -4000 : (sample > 4000) ? 4000 : sample;
+  }
+}
+
+// Exact (double) versions of the filters, with the same coefficients as filter.c
+static double reference_filter(double *value, double *rate, FilterMode mode, int32_t sample) {
+  double period = FILTER_PERIOD_MS / 1000.0;
+  double min_omega = (double)FILTER_PERIOD_MS / FILTER_TIME_CONSTANT_MS;
+  double omega = min_omega;
+  double diff = sample - *value;
+  
+  if (mode == FILTER_ADAPTIVE) {
+    double rate_omega = 2 * M_PI * period;
+    *rate += (rate_omega / (1 + rate_omega)) * ((diff / period) - *rate);
+    omega = min_omega + (2 * M_PI * period * 2 * fabs(*rate)) / 1000;
+  }
+  
+  *value += (omega / (1 + omega)) * diff;
+  return *value;
+}
+
+// Run the accelerometer input through a fixed-point filter and the exact filter, failing if they
+// are ever more than max_error apart. The fixed filter is also compared with the float filter it
+// replaced (FILTER_K 0.9, truncated to an int every sample)
+static void check_filter(const char *name, FilterMode mode, double max_error) {
+  static int32_t samples[ACCEL_SAMPLES];
+  if (!is_selected(name)) return;
+  
+  make_accel(samples, ACCEL_SAMPLES);
+  AxisFilter filter;
+  filter_configure(mode, FILTER_TIME_CONSTANT_MS, FILTER_PERIOD_MS);
+  filter_reset(&filter, samples[0]);
+  double value = samples[0];
+  double rate = 0;
+  int old = samples[0];
+  double worst = 0, total = 0, old_worst = 0, old_total = 0;
+  
+  for (int i = 1; i < ACCEL_SAMPLES; i++) {
+    double exact = reference_filter(&value, &rate, mode, samples[i]);
+    double error = fabs(filter_update(&filter, samples[i]) - exact);
+    worst = (error > worst) ? error : worst;
+    total += error;
+    
+    old = (old * 0.9) + (0.1 * samples[i]);
+    error = fabs(old - exact);
+    old_worst = (error > old_worst) ? error : old_worst;
+    old_total += error;
+  }
+  
+  bool ok = worst <= max_error;
+  if (!ok) s_inaccurate++;
+  printf("%-28s %9.2f max error %6.3f mean", name, worst, total / (ACCEL_SAMPLES - 1));
+  if (mode == FILTER_FIXED)
+    printf(" (old float filter %.2f max %.3f mean)", old_worst, old_total / (ACCEL_SAMPLES - 1));
+  printf("  %s\n", ok ? "ok" : "OUT OF BOUNDS");
+}
+
+// Report the worst error of a math function against libm, failing if it is more than max_error
+#define ACCEL_MAX 4000                              // Accelerometer range is +/-4g (in mg)
+#define SQUARES_MAX (3 * ACCEL_MAX * ACCEL_MAX)     // Largest sum of squares of accelerometer values
+#define MATH_SAMPLES 4000000
+
+static void report_error(const char *name, double worst, uint32_t checked, double max_error) {
+  bool ok = worst <= max_error;
+  if (!ok) s_inaccurate++;
+  printf("%-28s %9.2f max error (%u inputs)  %s\n", name, worst, checked, ok ? "ok" : "OUT OF BOUNDS");
+}
+
+// Square roots: every input over the accelerometer range, and a sample of the rest
+static void check_sqrt(void) {
+  if (!is_selected("accuracy-intsqrt")) return;
+  
+  double worst = 0, floor_worst = 0, rsqrt_worst = 0;
+  uint32_t checked = 0;
+  s_seed = 11;
+  for (uint64_t n = 0; n <= SQUARES_MAX + MATH_SAMPLES; n++) {
+    uint32_t input = (n <= SQUARES_MAX) ? (uint32_t)n : 
+      (((uint32_t)next_random(1 << 16) << 16) | (uint32_t)next_random(1 << 16));
+    double root = sqrt((double)input);
+    double error = fabs((double)intsqrt(input) - floor(root + 0.5));
+    worst = (error > worst) ? error : worst;
+    error = fabs((double)intsqrt_floor(input) - floor(root));
+    floor_worst = (error > floor_worst) ? error : floor_worst;
+    if (input > 0) {
+      error = fabs((double)intrsqrt(input) - (Q16_ONE / root));
+      rsqrt_worst = (error > rsqrt_worst) ? error : rsqrt_worst;
+    }
+    checked++;
+  }
+  
+  report_error("accuracy-intsqrt", worst, checked, 0);
+  report_error("accuracy-intsqrt_floor", floor_worst, checked, 0);
+  report_error("accuracy-intrsqrt", rsqrt_worst, checked, 1.0);
+}
+
+// Angles: a grid over the accelerometer range, and a sample of the full int32 range
+static void check_atan2(void) {
+  if (!is_selected("accuracy-intatan2")) return;
+  
+  double worst = 0;
+  uint32_t checked = 0;
+  s_seed = 13;
+  for (int32_t y = -ACCEL_MAX; y <= ACCEL_MAX + MATH_SAMPLES / (2 * ACCEL_MAX); y++) {
+    for (int32_t x = -ACCEL_MAX; x <= ACCEL_MAX; x += (y > ACCEL_MAX) ? 1 : 3) {
+      int32_t ay = y, ax = x;
+      if (y > ACCEL_MAX) {
+        ay = (int32_t)(((uint32_t)next_random(1 << 16) << 16) | (uint32_t)next_random(1 << 16));
+        ax = (int32_t)(((uint32_t)next_random(1 << 16) << 16) | (uint32_t)next_random(1 << 16));
+        if (ay == INT32_MIN || ax == INT32_MIN) continue;
+      }
+      if (ax == 0 && ay == 0) continue;
+      
+      // Difference in angle units, allowing for wrapping round at 360 degrees
+      double exact = atan2((double)ay, (double)ax) * 32768.0 / M_PI;
+      double error = fmod(fabs((double)intatan2(ay, ax) - exact), 65536.0);
+      if (error > 32768.0) error = 65536.0 - error;
+      worst = (error > worst) ? error : worst;
+      checked++;
+    }
+  }
+  
+  report_error("accuracy-intatan2", worst, checked, 2.0);
+}
+
+static void check_accuracy(void) {
+  check_filter("accuracy-filter-fixed", FILTER_FIXED, 1.0);
+  check_filter("accuracy-filter-adaptive", FILTER_ADAPTIVE, 1.0);
+  check_sqrt();
+  check_atan2();
+}
+
+int main(int argc, char **argv) {
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--write") == 0 && i + 1 < argc) {
+      s_write_dir = argv[++i];
+    } else if (strcmp(argv[i], "--check") == 0 && i + 1 < argc) {
+      s_check_dir = argv[++i];
+    } else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+      s_filter = argv[++i];
+    } else {
+      fprintf(stderr, "Usage: %s [--write DIR | --check DIR] [--filter TEXT]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  make_jitter(&s_corpora[0]);
+  make_diagonals(&s_corpora[1]);
+  make_sweeps(&s_corpora[2]);
+
+  for (int c = 0; c < 3; c++) {
+    for (int width = 1; width <= 9; width += 2)
+      bench_raster(&s_corpora[c], BRUSH_PEN, width);
+    for (int width = 1; width <= 15; width += 2)
+      bench_raster(&s_corpora[c], BRUSH_ERASER_SQUARE, width);
+    for (int width = 1; width <= 15; width += 2)
+      bench_raster(&s_corpora[c], BRUSH_ERASER_ROUND, width);
+    bench_canvas(&s_corpora[c], 3);
+  }
+
+  bench_math();
+  check_accuracy();
+
+  if (s_inaccurate > 0) {
+    printf("%d accuracy check(s) out of bounds\n", s_inaccurate);
+    return 1;
+  }
+  if (s_failures > 0) {
+    printf("%d image(s) %s\n", s_failures, (s_write_dir != NULL) ? "not written" : "differ from the saved images");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,60 @@
+#include <pebble.h>
+#include <stdio.h>
+#include "pbm.h"
+#include "common.h"
+
+// PBM rows have the leftmost pixel in the highest bit and 1 for black, where image data has the
+// leftmost pixel in the lowest bit and 1 for white
+
+#define PBM_ROW_BYTES (IMG_WIDTH / 8)
+
+static uint8_t reverse_bits(uint8_t byte) {
+  uint8_t reversed = 0;
+  for (int bit = 0; bit < 8; bit++) {
+    if (byte & (1 << bit)) reversed |= 0x80 >> bit;
+  }
+  return reversed;
+}
+
+static int pbm_header(char *header, size_t size) {
+  return snprintf(header, size, "P4\n%d %d\n", IMG_WIDTH, IMG_HEIGHT);
+}
+
+bool pbm_write(const char *path, const uint8_t *image) {
+  char header[32];
+  uint8_t row[PBM_ROW_BYTES];
+  int header_len = pbm_header(header, sizeof(header));
+  
+  FILE *file = fopen(path, "wb");
+  if (file == NULL) return false;
+  
+  bool ok = fwrite(header, 1, header_len, file) == (size_t)header_len;
+  for (int y = 0; y < IMG_HEIGHT && ok; y++) {
+    for (int x = 0; x < PBM_ROW_BYTES; x++)
+      row[x] = ~reverse_bits(image[(y * IMG_ROW_BYTES) + x]);
+    ok = fwrite(row, 1, sizeof(row), file) == sizeof(row);
+  }
+  return (fclose(file) == 0) && ok;
+}
+
+// Read a file written by pbm_write (only the exact same header is accepted)
+bool pbm_read(const char *path, uint8_t *image) {
+  char header[32];
+  char saved_header[32];
+  uint8_t row[PBM_ROW_BYTES];
+  int header_len = pbm_header(header, sizeof(header));
+  
+  FILE *file = fopen(path, "rb");
+  if (file == NULL) return false;
+  
+  bool ok = fread(saved_header, 1, header_len, file) == (size_t)header_len &&
+            memcmp(saved_header, header, header_len) == 0;
+  memset(image, 0xFF, IMG_PIXELS);
+  for (int y = 0; y < IMG_HEIGHT && ok; y++) {
+    ok = fread(row, 1, sizeof(row), file) == sizeof(row);
+    for (int x = 0; x < PBM_ROW_BYTES && ok; x++)
+      image[(y * IMG_ROW_BYTES) + x] = reverse_bits(~row[x]);
+  }
+  fclose(file);
+  return ok;
+}
@@ -0,0 +1,6 @@
+#pragma once
+#include <pebble.h>
+
+// Reading and writing image data (IMG_ROW_BYTES per row) as binary PBM (P4) files
+bool pbm_write(const char *path, const uint8_t *image);
+bool pbm_read(const char *path, uint8_t *image);
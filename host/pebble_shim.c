@@ -0,0 +1,687 @@
+#include <pebble.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include "shim.h"
+
+// Host implementation of the Pebble SDK calls used by the drawing code. Drawing goes into an
+// in-memory 1-bit framebuffer the same size and layout as the watch's, time only moves when the
+// host advances it (firing any timers that are due), and each SDK call is counted so the host can
+// check what the code asked the watch to do
+
+#define SCREEN_WIDTH 144
+#define SCREEN_HEIGHT 168
+#define MAX_CALL_NAMES 64
+#define MAX_TIMERS 32
+#define MAX_PERSIST_KEYS 512
+#define MAX_WINDOWS 8
+#define SHIM_HEAP_FREE 16384  // Heap reported free (about what the app has left on the watch)
+
+// Calls made, counted by function name
+typedef struct {
+  const char *name;
+  uint32_t count;
+} CallCount;
+
+static CallCount s_calls[MAX_CALL_NAMES];
+static int s_call_names = 0;
+static bool s_logging = false;
+
+struct AppTimer {
+  bool active;
+  uint32_t due;
+  AppTimerCallback callback;
+  void *data;
+};
+
+static struct AppTimer s_timers[MAX_TIMERS];
+static uint32_t s_now = 0;
+
+typedef struct {
+  uint32_t key;
+  int size;
+  uint8_t data[PERSIST_DATA_MAX_LENGTH];
+} PersistEntry;
+
+static PersistEntry s_persist[MAX_PERSIST_KEYS];
+static int s_persist_count = 0;
+
+struct Layer {
+  GRect frame;
+  LayerUpdateProc update_proc;
+  bool hidden;
+  bool dirty;
+  Layer *parent;
+  Layer *first_child;
+  Layer *next_sibling;
+};
+
+struct Window {
+  Layer *root;
+  WindowHandlers handlers;
+  ClickConfigProvider click_config_provider;
+  GColor background_color;
+  bool loaded;
+};
+
+static Window *s_window_stack[MAX_WINDOWS];
+static int s_window_count = 0;
+
+struct GContext {
+  GBitmap *framebuffer;
+  GColor stroke_color;
+  GColor fill_color;
+  GCompOp compositing_mode;
+  GPoint offset;  // Origin of the layer being drawn
+  GRect clip;     // Area of the screen the layer can draw in
+  bool captured;  // Set while the framebuffer is captured (drawing calls are ignored)
+};
+
+static uint8_t s_screen_pixels[SCREEN_HEIGHT * 20];
+static GBitmap s_screen = { s_screen_pixels, 20, 0, { { 0, 0 }, { SCREEN_WIDTH, SCREEN_HEIGHT } } };
+static GContext s_context;
+
+// Count a call to an SDK function
+static void record(const char *name) {
+  for (int i = 0; i < s_call_names; i++) {
+    if (strcmp(s_calls[i].name, name) == 0) {
+      s_calls[i].count++;
+      return;
+    }
+  }
+
+  if (s_call_names < MAX_CALL_NAMES) {
+    s_calls[s_call_names].name = name;
+    s_calls[s_call_names].count = 1;
+    s_call_names++;
+  }
+}
+
+// Number of calls to an SDK function since the calls were cleared
+uint32_t shim_call_count(const char *name) {
+  for (int i = 0; i < s_call_names; i++) {
+    if (strcmp(s_calls[i].name, name) == 0) return s_calls[i].count;
+  }
+  return 0;
+}
+
+void shim_clear_calls(void) {
+  s_call_names = 0;
+}
+
+// Print APP_LOG messages to stderr (off by default)
+void shim_set_logging(bool enabled) {
+  s_logging = enabled;
+}
+
+// Forget all state: calls, timers, storage, windows and the screen contents
+void shim_reset(void) {
+  shim_clear_calls();
+  memset(s_timers, 0, sizeof(s_timers));
+  s_now = 0;
+  s_persist_count = 0;
+  s_window_count = 0;
+  memset(s_screen_pixels, 0xFF, sizeof(s_screen_pixels));
+}
+
+void app_log(uint8_t log_level, const char *src_filename, int src_line_number, const char *fmt, ...) {
+  record("app_log");
+  if (!s_logging) return;
+
+  va_list args;
+  va_start(args, fmt);
+  fprintf(stderr, "[%u] %s:%d ", s_now, src_filename, src_line_number);
+  vfprintf(stderr, fmt, args);
+  fprintf(stderr, "\n");
+  va_end(args);
+}
+
+// Memory
+
+size_t heap_bytes_free(void) {
+  record("heap_bytes_free");
+  return SHIM_HEAP_FREE;
+}
+
+// Time
+
+uint16_t time_ms(time_t *tloc, uint16_t *out_ms) {
+  record("time_ms");
+  if (tloc != NULL) *tloc = s_now / 1000;
+  if (out_ms != NULL) *out_ms = s_now % 1000;
+  return s_now % 1000;
+}
+
+// Current virtual time in ms
+uint32_t shim_now(void) {
+  return s_now;
+}
+
+// Move time forward, firing the timers that become due in order
+void shim_advance(uint32_t ms) {
+  uint32_t end = s_now + ms;
+
+  for (;;) {
+    struct AppTimer *next = NULL;
+    for (int i = 0; i < MAX_TIMERS; i++) {
+      if (s_timers[i].active && s_timers[i].due <= end && (next == NULL || s_timers[i].due < next->due))
+        next = &s_timers[i];
+    }
+    if (next == NULL) break;
+
+    if (next->due > s_now) s_now = next->due;
+    next->active = false;
+    next->callback(next->data);
+  }
+
+  s_now = end;
+}
+
+AppTimer *app_timer_register(uint32_t timeout_ms, AppTimerCallback callback, void *callback_data) {
+  record("app_timer_register");
+  for (int i = 0; i < MAX_TIMERS; i++) {
+    if (!s_timers[i].active) {
+      s_timers[i] = (struct AppTimer) { true, s_now + timeout_ms, callback, callback_data };
+      return &s_timers[i];
+    }
+  }
+  return NULL;
+}
+
+bool app_timer_reschedule(AppTimer *timer_handle, uint32_t new_timeout_ms) {
+  record("app_timer_reschedule");
+  if (timer_handle == NULL || !timer_handle->active) return false;
+  timer_handle->due = s_now + new_timeout_ms;
+  return true;
+}
+
+void app_timer_cancel(AppTimer *timer_handle) {
+  record("app_timer_cancel");
+  if (timer_handle != NULL) timer_handle->active = false;
+}
+
+// Storage
+
+static PersistEntry *find_persist(uint32_t key) {
+  for (int i = 0; i < s_persist_count; i++) {
+    if (s_persist[i].key == key) return &s_persist[i];
+  }
+  return NULL;
+}
+
+bool persist_exists(const uint32_t key) {
+  record("persist_exists");
+  return find_persist(key) != NULL;
+}
+
+int persist_get_size(const uint32_t key) {
+  record("persist_get_size");
+  PersistEntry *entry = find_persist(key);
+  return (entry != NULL) ? entry->size : -1;
+}
+
+int persist_read_data(const uint32_t key, void *buffer, const size_t buffer_size) {
+  record("persist_read_data");
+  PersistEntry *entry = find_persist(key);
+  if (entry == NULL) return -1;
+
+  int len = (entry->size < (int)buffer_size) ? entry->size : (int)buffer_size;
+  memcpy(buffer, entry->data, len);
+  return len;
+}
+
+int persist_write_data(const uint32_t key, const void *data, const size_t size) {
+  record("persist_write_data");
+  if (size > PERSIST_DATA_MAX_LENGTH) return -1;
+
+  PersistEntry *entry = find_persist(key);
+  if (entry == NULL) {
+    if (s_persist_count >= MAX_PERSIST_KEYS) return -1;
+    entry = &s_persist[s_persist_count++];
+    entry->key = key;
+  }
+  memcpy(entry->data, data, size);
+  entry->size = size;
+  return size;
+}
+
+int32_t persist_read_int(const uint32_t key) {
+  int32_t value = 0;
+  persist_read_data(key, &value, sizeof(value));
+  return value;
+}
+
+bool persist_read_bool(const uint32_t key) {
+  return persist_read_int(key) != 0;
+}
+
+int persist_write_int(const uint32_t key, const int32_t value) {
+  return persist_write_data(key, &value, sizeof(value));
+}
+
+int persist_write_bool(const uint32_t key, const bool value) {
+  return persist_write_int(key, value);
+}
+
+int persist_delete(const uint32_t key) {
+  record("persist_delete");
+  PersistEntry *entry = find_persist(key);
+  if (entry == NULL) return -1;
+  *entry = s_persist[--s_persist_count];
+  return 0;
+}
+
+// Bitmaps
+
+GBitmap *gbitmap_create_blank(GSize size) {
+  record("gbitmap_create_blank");
+  GBitmap *bitmap = malloc(sizeof(GBitmap));
+  if (bitmap == NULL) return NULL;
+
+  // Rows are padded to whole 32-bit words, like the watch
+  bitmap->row_size_bytes = ((size.w + 31) / 32) * 4;
+  bitmap->info_flags = 0;
+  bitmap->bounds = GRect(0, 0, size.w, size.h);
+  bitmap->addr = calloc(size.h, bitmap->row_size_bytes);
+  if (bitmap->addr == NULL) {
+    free(bitmap);
+    return NULL;
+  }
+  return bitmap;
+}
+
+void gbitmap_destroy(GBitmap *bitmap) {
+  record("gbitmap_destroy");
+  if (bitmap == NULL) return;
+  free(bitmap->addr);
+  free(bitmap);
+}
+
+// Drawing (into the framebuffer, in the coordinates of the layer being drawn)
+
+static void set_pixel(GContext *ctx, int x, int y, GColor color) {
+  if (ctx->captured || color == GColorClear) return;
+
+  x += ctx->offset.x;
+  y += ctx->offset.y;
+  if (x < ctx->clip.origin.x || x >= ctx->clip.origin.x + ctx->clip.size.w ||
+      y < ctx->clip.origin.y || y >= ctx->clip.origin.y + ctx->clip.size.h) return;
+
+  uint8_t *byte = (uint8_t *)ctx->framebuffer->addr + (y * ctx->framebuffer->row_size_bytes) + (x / 8);
+  if (color == GColorWhite)
+    *byte |= 1 << (x % 8);
+  else
+    *byte &= ~(1 << (x % 8));
+}
+
+static void fill_span(GContext *ctx, int x0, int x1, int y, GColor color) {
+  for (int x = x0; x <= x1; x++) set_pixel(ctx, x, y, color);
+}
+
+void graphics_context_set_stroke_color(GContext *ctx, GColor color) {
+  record("graphics_context_set_stroke_color");
+  ctx->stroke_color = color;
+}
+
+void graphics_context_set_fill_color(GContext *ctx, GColor color) {
+  record("graphics_context_set_fill_color");
+  ctx->fill_color = color;
+}
+
+// Compositing only applies to bitmaps, which the host build doesn't draw
+void graphics_context_set_compositing_mode(GContext *ctx, GCompOp mode) {
+  record("graphics_context_set_compositing_mode");
+  ctx->compositing_mode = mode;
+}
+
+void graphics_draw_pixel(GContext *ctx, GPoint point) {
+  record("graphics_draw_pixel");
+  set_pixel(ctx, point.x, point.y, ctx->stroke_color);
+}
+
+// 1 pixel wide line (Bresenham)
+void graphics_draw_line(GContext *ctx, GPoint p0, GPoint p1) {
+  record("graphics_draw_line");
+  int dx = abs(p1.x - p0.x);
+  int dy = -abs(p1.y - p0.y);
+  int sx = (p0.x < p1.x) ? 1 : -1;
+  int sy = (p0.y < p1.y) ? 1 : -1;
+  int err = dx + dy;
+  int x = p0.x;
+  int y = p0.y;
+
+  for (;;) {
+    set_pixel(ctx, x, y, ctx->stroke_color);
+    if (x == p1.x && y == p1.y) break;
+    int e2 = 2 * err;
+    if (e2 >= dy) {
+      err += dy;
+      x += sx;
+    }
+    if (e2 <= dx) {
+      err += dx;
+      y += sy;
+    }
+  }
+}
+
+void graphics_draw_rect(GContext *ctx, GRect rect) {
+  record("graphics_draw_rect");
+  if (rect.size.w <= 0 || rect.size.h <= 0) return;
+
+  int x1 = rect.origin.x + rect.size.w - 1;
+  int y1 = rect.origin.y + rect.size.h - 1;
+  fill_span(ctx, rect.origin.x, x1, rect.origin.y, ctx->stroke_color);
+  fill_span(ctx, rect.origin.x, x1, y1, ctx->stroke_color);
+  for (int y = rect.origin.y + 1; y < y1; y++) {
+    set_pixel(ctx, rect.origin.x, y, ctx->stroke_color);
+    set_pixel(ctx, x1, y, ctx->stroke_color);
+  }
+}
+
+// Corners are always square
+void graphics_fill_rect(GContext *ctx, GRect rect, uint16_t corner_radius, GCornerMask corner_mask) {
+  record("graphics_fill_rect");
+  for (int y = rect.origin.y; y < rect.origin.y + rect.size.h; y++)
+    fill_span(ctx, rect.origin.x, rect.origin.x + rect.size.w - 1, y, ctx->fill_color);
+}
+
+// Circle outline (midpoint circle)
+void graphics_draw_circle(GContext *ctx, GPoint p, uint16_t radius) {
+  record("graphics_draw_circle");
+  int x = radius;
+  int y = 0;
+  int err = 1 - x;
+
+  while (x >= y) {
+    set_pixel(ctx, p.x + x, p.y + y, ctx->stroke_color);
+    set_pixel(ctx, p.x + y, p.y + x, ctx->stroke_color);
+    set_pixel(ctx, p.x - y, p.y + x, ctx->stroke_color);
+    set_pixel(ctx, p.x - x, p.y + y, ctx->stroke_color);
+    set_pixel(ctx, p.x - x, p.y - y, ctx->stroke_color);
+    set_pixel(ctx, p.x - y, p.y - x, ctx->stroke_color);
+    set_pixel(ctx, p.x + y, p.y - x, ctx->stroke_color);
+    set_pixel(ctx, p.x + x, p.y - y, ctx->stroke_color);
+    y++;
+    if (err < 0) {
+      err += (2 * y) + 1;
+    } else {
+      x--;
+      err += 2 * (y - x) + 1;
+    }
+  }
+}
+
+// Filled circle (every pixel within radius + 1/2 of the center)
+void graphics_fill_circle(GContext *ctx, GPoint p, uint16_t radius) {
+  record("graphics_fill_circle");
+  int r = radius;
+
+  for (int v = -r; v <= r; v++) {
+    int limit = (r * r) + r - (v * v);
+    int half = 0;
+    while ((half + 1) * (half + 1) <= limit) half++;
+    fill_span(ctx, p.x - half, p.x + half, p.y + v, ctx->fill_color);
+  }
+}
+
+GBitmap *graphics_capture_frame_buffer(GContext *ctx) {
+  record("graphics_capture_frame_buffer");
+  if (ctx->captured) return NULL;
+  ctx->captured = true;
+  return ctx->framebuffer;
+}
+
+bool graphics_release_frame_buffer(GContext *ctx, GBitmap *buffer) {
+  record("graphics_release_frame_buffer");
+  if (!ctx->captured || buffer != ctx->framebuffer) return false;
+  ctx->captured = false;
+  return true;
+}
+
+// The screen contents
+GBitmap *shim_framebuffer(void) {
+  return &s_screen;
+}
+
+// Layers
+
+Layer *layer_create(GRect frame) {
+  record("layer_create");
+  Layer *layer = calloc(1, sizeof(Layer));
+  if (layer != NULL) layer->frame = frame;
+  return layer;
+}
+
+// Unlink a layer from its parent
+static void remove_from_parent(Layer *layer) {
+  if (layer->parent == NULL) return;
+
+  Layer **link = &layer->parent->first_child;
+  while (*link != NULL && *link != layer) link = &(*link)->next_sibling;
+  if (*link != NULL) *link = layer->next_sibling;
+  layer->parent = NULL;
+  layer->next_sibling = NULL;
+}
+
+void layer_destroy(Layer *layer) {
+  record("layer_destroy");
+  if (layer == NULL) return;
+
+  remove_from_parent(layer);
+  for (Layer *child = layer->first_child; child != NULL; child = child->next_sibling)
+    child->parent = NULL;
+  free(layer);
+}
+
+void layer_mark_dirty(Layer *layer) {
+  record("layer_mark_dirty");
+  layer->dirty = true;
+}
+
+void layer_set_update_proc(Layer *layer, LayerUpdateProc update_proc) {
+  record("layer_set_update_proc");
+  layer->update_proc = update_proc;
+}
+
+void layer_set_frame(Layer *layer, GRect frame) {
+  record("layer_set_frame");
+  layer->frame = frame;
+  layer->dirty = true;
+}
+
+GRect layer_get_frame(const Layer *layer) {
+  return layer->frame;
+}
+
+GRect layer_get_bounds(const Layer *layer) {
+  return GRect(0, 0, layer->frame.size.w, layer->frame.size.h);
+}
+
+void layer_set_hidden(Layer *layer, bool hidden) {
+  record("layer_set_hidden");
+  if (layer->hidden != hidden) layer->dirty = true;
+  layer->hidden = hidden;
+}
+
+bool layer_get_hidden(const Layer *layer) {
+  return layer->hidden;
+}
+
+// Children are drawn in the order they were added (last on top)
+void layer_add_child(Layer *parent, Layer *child) {
+  record("layer_add_child");
+  remove_from_parent(child);
+
+  Layer **link = &parent->first_child;
+  while (*link != NULL) link = &(*link)->next_sibling;
+  *link = child;
+  child->parent = parent;
+  parent->dirty = true;
+}
+
+// Indicates if a layer or any of its children are marked dirty (and clears the marks)
+static bool take_dirty(Layer *layer) {
+  bool dirty = layer->dirty;
+  layer->dirty = false;
+  for (Layer *child = layer->first_child; child != NULL; child = child->next_sibling) {
+    if (take_dirty(child)) dirty = true;
+  }
+  return dirty;
+}
+
+// Draw a layer and its children, returning the number of layers drawn
+static int draw_layer(Layer *layer, GPoint origin, GRect clip) {
+  if (layer->hidden) return 0;
+
+  origin.x += layer->frame.origin.x;
+  origin.y += layer->frame.origin.y;
+
+  // Clip to the layer's frame
+  int x0 = (origin.x > clip.origin.x) ? origin.x : clip.origin.x;
+  int y0 = (origin.y > clip.origin.y) ? origin.y : clip.origin.y;
+  int x1 = origin.x + layer->frame.size.w;
+  int y1 = origin.y + layer->frame.size.h;
+  if (x1 > clip.origin.x + clip.size.w) x1 = clip.origin.x + clip.size.w;
+  if (y1 > clip.origin.y + clip.size.h) y1 = clip.origin.y + clip.size.h;
+  if (x1 <= x0 || y1 <= y0) return 0;
+  clip = GRect(x0, y0, x1 - x0, y1 - y0);
+
+  int drawn = 0;
+  if (layer->update_proc != NULL) {
+    s_context.offset = origin;
+    s_context.clip = clip;
+    s_context.captured = false;
+    layer->update_proc(layer, &s_context);
+    drawn++;
+  }
+
+  for (Layer *child = layer->first_child; child != NULL; child = child->next_sibling)
+    drawn += draw_layer(child, origin, clip);
+  return drawn;
+}
+
+// Redraw the top window if any of its layers are dirty (like the watch, every layer is drawn, and
+// the framebuffer keeps its contents if the window background is clear). Returns the number of
+// layers drawn
+int shim_redraw(void) {
+  Window *window = window_stack_get_top_window();
+  if (window == NULL || !take_dirty(window->root)) return 0;
+
+  record("redraw");
+  s_context = (GContext) {
+    .framebuffer = &s_screen,
+    .stroke_color = GColorBlack,
+    .fill_color = GColorBlack,
+    .compositing_mode = GCompOpAssign
+  };
+
+  if (window->background_color != GColorClear)
+    memset(s_screen_pixels, (window->background_color == GColorWhite) ? 0xFF : 0x00, sizeof(s_screen_pixels));
+
+  return draw_layer(window->root, GPointZero, GRect(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT));
+}
+
+// Windows
+
+Window *window_create(void) {
+  record("window_create");
+  Window *window = calloc(1, sizeof(Window));
+  if (window == NULL) return NULL;
+
+  window->root = layer_create(GRect(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT));
+  window->background_color = GColorWhite;
+  return window;
+}
+
+void window_destroy(Window *window) {
+  record("window_destroy");
+  if (window == NULL) return;
+  window_stack_remove(window, false);
+  layer_destroy(window->root);
+  free(window);
+}
+
+void window_set_click_config_provider(Window *window, ClickConfigProvider click_config_provider) {
+  record("window_set_click_config_provider");
+  window->click_config_provider = click_config_provider;
+}
+
+void window_set_window_handlers(Window *window, WindowHandlers handlers) {
+  record("window_set_window_handlers");
+  window->handlers = handlers;
+}
+
+Layer *window_get_root_layer(const Window *window) {
+  return window->root;
+}
+
+void window_set_background_color(Window *window, GColor background_color) {
+  record("window_set_background_color");
+  window->background_color = background_color;
+}
+
+void window_set_fullscreen(Window *window, bool enabled) {
+  record("window_set_fullscreen");
+}
+
+void window_stack_push(Window *window, bool animated) {
+  record("window_stack_push");
+  if (s_window_count >= MAX_WINDOWS) return;
+
+  Window *top = window_stack_get_top_window();
+  if (top != NULL && top->handlers.disappear != NULL) top->handlers.disappear(top);
+
+  s_window_stack[s_window_count++] = window;
+  if (!window->loaded) {
+    window->loaded = true;
+    if (window->handlers.load != NULL) window->handlers.load(window);
+  }
+  if (window->handlers.appear != NULL) window->handlers.appear(window);
+  window->root->dirty = true;
+}
+
+bool window_stack_remove(Window *window, bool animated) {
+  record("window_stack_remove");
+  for (int i = 0; i < s_window_count; i++) {
+    if (s_window_stack[i] != window) continue;
+
+    bool was_top = (i == s_window_count - 1);
+    memmove(&s_window_stack[i], &s_window_stack[i + 1], (s_window_count - i - 1) * sizeof(Window *));
+    s_window_count--;
+
+    if (was_top && window->handlers.disappear != NULL) window->handlers.disappear(window);
+    window->loaded = false;
+    if (window->handlers.unload != NULL) window->handlers.unload(window);
+
+    // The window below is shown again
+    Window *top = window_stack_get_top_window();
+    if (was_top && top != NULL) {
+      if (top->handlers.appear != NULL) top->handlers.appear(top);
+      top->root->dirty = true;
+    }
+    return true;
+  }
+  return false;
+}
+
+Window *window_stack_get_top_window(void) {
+  return (s_window_count > 0) ? s_window_stack[s_window_count - 1] : NULL;
+}
+
+// Vibes and light
+
+void vibes_short_pulse(void) {
+  record("vibes_short_pulse");
+}
+
+void vibes_double_pulse(void) {
+  record("vibes_double_pulse");
+}
+
+void light_enable(bool enable) {
+  record("light_enable");
+}
+
+void light_enable_interaction(void) {
+  record("light_enable_interaction");
+}
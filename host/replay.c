@@ -0,0 +1,356 @@
+#include <pebble.h>
+#include <stdio.h>
+#include "shim.h"
+#include "common.h"
+#include "canvas.h"
+#include "filter.h"
+#include "tracking.h"
+#include "trace.h"
+#include "pbm.h"
+
+// Replays a trace recorded on the watch (see src/trace.c) through the same tracking and canvas
+// code as the app, so a drawing session can be reproduced exactly while tuning the filters,
+// sensitivity or drawing. Takes the saved output of 'pebble logs' (the last session in it is
+// replayed), writes the resulting drawing and prints the time spent in each stage.
+//
+// Usage: draw-replay [--out FILE.pbm] [--image FILE.pbm] [--sensitivity high|medium|low]
+//                    [--smoothing fixed|adaptive] [--every-sample on|off] [--pen WIDTH] LOG
+// The settings options replace the ones recorded in the trace.
+
+#define MAX_LINE 512
+
+// Time spent in one stage of handling the recorded events
+typedef struct {
+  const char *name;
+  uint32_t calls;
+  uint64_t total_ns;
+  uint64_t max_ns;
+} Stage;
+
+enum {
+  STAGE_TRACKING,  // Accelerometer batch to cursor path (tracking_process)
+  STAGE_CURSOR,    // Moving the cursor through the path and drawing into the image
+  STAGE_REDRAW,    // Redrawing the window (copying changed image rows to the framebuffer)
+  STAGE_COUNT
+};
+
+static Stage s_stages[STAGE_COUNT] = { { "tracking" }, { "cursor" }, { "redraw" } };
+
+// Settings given on the command line (-1 to use the recorded ones)
+static int s_max_tilt = -1;
+static int s_adaptive = -1;
+static int s_every_sample = -1;
+static int s_pen_width = -1;
+
+// App state the recorded events depend on
+static bool s_infocus = true;
+static bool s_secondshake_clear = false;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((uint64_t)ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+static void add_time(int stage, uint64_t start) {
+  uint64_t elapsed = now_ns() - start;
+  s_stages[stage].calls++;
+  s_stages[stage].total_ns += elapsed;
+  if (elapsed > s_stages[stage].max_ns) s_stages[stage].max_ns = elapsed;
+}
+
+static uint16_t get16(const uint8_t *src) {
+  return src[0] | (src[1] << 8);
+}
+
+static int hex_value(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+// Collect the trace bytes of the last session in a log, returning the number of bytes (or -1)
+static long read_trace(const char *path, uint8_t **trace) {
+  char line[MAX_LINE];
+  long length = 0;
+  long capacity = 0;
+  int next_line = 0;
+
+  FILE *file = fopen(path, "r");
+  if (file == NULL) return -1;
+
+  *trace = NULL;
+  while (fgets(line, sizeof(line), file) != NULL) {
+    char *text = strstr(line, TRACE_LOG_MARKER " ");
+    if (text == NULL) continue;
+    text += strlen(TRACE_LOG_MARKER " ");
+
+    // A new session replaces anything read before it
+    if (strncmp(text, "start", 5) == 0) {
+      length = 0;
+      next_line = 0;
+      continue;
+    }
+
+    int line_number;
+    int offset;
+    if (sscanf(text, "%d %n", &line_number, &offset) != 1) continue;
+    if (line_number != next_line)
+      fprintf(stderr, "Trace lines %d to %d are missing from the log - the replay will not match\n",
+              next_line, line_number - 1);
+    next_line = (line_number + 1) % 1000;
+
+    for (text += offset; hex_value(text[0]) >= 0 && hex_value(text[1]) >= 0; text += 2) {
+      if (length == capacity) {
+        capacity = (capacity == 0) ? 4096 : capacity * 2;
+        *trace = realloc(*trace, capacity);
+      }
+      (*trace)[length++] = (hex_value(text[0]) << 4) | hex_value(text[1]);
+    }
+  }
+  fclose(file);
+  return length;
+}
+
+// Apply recorded settings the same way the app does when loading them
+static void apply_config(const uint8_t *record) {
+  uint8_t flags = record[1];
+  bool every_sample = (s_every_sample >= 0) ? s_every_sample : (flags & TRACE_EVERY_SAMPLE) != 0;
+  bool adaptive = (s_adaptive >= 0) ? s_adaptive : (flags & TRACE_ADAPTIVE) != 0;
+
+  set_drawingcursor((flags & TRACE_DRAWING_CURSOR) != 0);
+  tracking_configure((s_max_tilt >= 0) ? s_max_tilt : get16(&record[4]), every_sample);
+  set_penwith((s_pen_width >= 0) ? s_pen_width : record[2]);
+  set_eraserwidth(record[3]);
+  set_erasershape((flags & TRACE_ERASER_ROUND) != 0);
+  s_secondshake_clear = (flags & TRACE_SECONDSHAKE_CLEAR) != 0;
+  filter_configure(adaptive ? FILTER_ADAPTIVE : FILTER_FIXED, FILTER_TIME_CONSTANT,
+                   every_sample ? (ACCEL_BATCH_PERIOD / ACCEL_BATCH_SIZE) : ACCEL_BATCH_PERIOD);
+}
+
+// Handle a recorded event the same way the app's handlers do
+static void apply_event(TraceEvent event, uint8_t value) {
+  switch (event) {
+    case TRACE_UP_CLICK:
+      set_paused();
+      tracking_recenter();
+      break;
+    case TRACE_SELECT_CLICK:
+      toggle_pen();
+      break;
+    case TRACE_SELECT_HOLD:
+      toggle_eraser();
+      break;
+    case TRACE_DOWN_CLICK:
+      // The settings window opens here (any settings changed are recorded when it closes)
+      set_paused();
+      break;
+    case TRACE_TAP:
+      if (!is_pen_down() && value == ACCEL_AXIS_Y && s_infocus && is_canvas_on_top()) {
+        if (has_undo())
+          undo_image();
+        else if (s_secondshake_clear)
+          clear_image();
+        else if (has_redo())
+          redo_image();
+      }
+      break;
+    case TRACE_FOCUS:
+      if (!value) set_paused();
+      s_infocus = value;
+      break;
+    case TRACE_RECENTER:
+      tracking_recenter();
+      break;
+  }
+}
+
+// Run an accelerometer batch through tracking and the canvas, timing each stage
+static void apply_accel(const uint8_t *record, uint32_t time, uint32_t *points) {
+  AccelData data[8];
+  GPoint path[8];
+  uint8_t count = record[1];
+  const uint8_t *sample = &record[TRACE_ACCEL_HEADER_SIZE];
+
+  for (int i = 0; i < count; i++) {
+    time += sample[6];
+    data[i] = (AccelData) { .x = (int16_t)get16(&sample[0]), .y = (int16_t)get16(&sample[2]),
+                            .z = (int16_t)get16(&sample[4]), .did_vibrate = (record[2] >> i) & 1,
+                            .timestamp = time };
+    sample += TRACE_SAMPLE_SIZE;
+  }
+
+  if (!s_infocus) return;
+
+  uint64_t start = now_ns();
+  uint8_t path_count = tracking_process(data, count, path, ACCEL_BATCH_SIZE);
+  add_time(STAGE_TRACKING, start);
+
+  if (path_count > 0) {
+    start = now_ns();
+    cursor_set_path(path, path_count);
+    add_time(STAGE_CURSOR, start);
+    *points += path_count;
+  }
+}
+
+// Size of the record at the start of the trace (0 if it is incomplete or unknown)
+static long record_size(const uint8_t *record, long remaining) {
+  long size = 0;
+  switch (record[0]) {
+    case TRACE_RECORD_ACCEL:
+      size = (remaining >= 2 && record[1] <= 8) ? TRACE_ACCEL_HEADER_SIZE + (record[1] * TRACE_SAMPLE_SIZE) : 0;
+      break;
+    case TRACE_RECORD_EVENT:
+      size = TRACE_EVENT_SIZE;
+      break;
+    case TRACE_RECORD_CONFIG:
+      size = TRACE_CONFIG_SIZE;
+      break;
+  }
+  return (size <= remaining) ? size : 0;
+}
+
+static bool parse_on_off(const char *text, int *value) {
+  if (strcmp(text, "on") == 0) *value = 1;
+  else if (strcmp(text, "off") == 0) *value = 0;
+  else return false;
+  return true;
+}
+
+static int usage(const char *program) {
+  fprintf(stderr, "Usage: %s [--out FILE.pbm] [--image FILE.pbm] [--sensitivity high|medium|low]\n"
+                  "          [--smoothing fixed|adaptive] [--every-sample on|off] [--pen WIDTH] LOG\n", program);
+  return 2;
+}
+
+int main(int argc, char **argv) {
+  const char *out_path = "replay.pbm";
+  const char *image_path = NULL;
+  const char *log_path = NULL;
+
+  for (int i = 1; i < argc; i++) {
+    bool has_value = i + 1 < argc;
+    if (strcmp(argv[i], "--out") == 0 && has_value) {
+      out_path = argv[++i];
+    } else if (strcmp(argv[i], "--image") == 0 && has_value) {
+      image_path = argv[++i];
+    } else if (strcmp(argv[i], "--sensitivity") == 0 && has_value) {
+      i++;
+      if (strcmp(argv[i], "high") == 0) s_max_tilt = HIGH_TILT;
+      else if (strcmp(argv[i], "medium") == 0) s_max_tilt = MEDIUM_TILT;
+      else if (strcmp(argv[i], "low") == 0) s_max_tilt = LOW_TILT;
+      else return usage(argv[0]);
+    } else if (strcmp(argv[i], "--smoothing") == 0 && has_value) {
+      i++;
+      if (strcmp(argv[i], "fixed") == 0) s_adaptive = 0;
+      else if (strcmp(argv[i], "adaptive") == 0) s_adaptive = 1;
+      else return usage(argv[0]);
+    } else if (strcmp(argv[i], "--every-sample") == 0 && has_value) {
+      if (!parse_on_off(argv[++i], &s_every_sample)) return usage(argv[0]);
+    } else if (strcmp(argv[i], "--pen") == 0 && has_value) {
+      s_pen_width = atoi(argv[++i]);
+      if (s_pen_width < 1 || s_pen_width > 15 || s_pen_width % 2 == 0) return usage(argv[0]);
+    } else if (argv[i][0] != '-' && log_path == NULL) {
+      log_path = argv[i];
+    } else {
+      return usage(argv[0]);
+    }
+  }
+  if (log_path == NULL) return usage(argv[0]);
+
+  uint8_t *trace;
+  long length = read_trace(log_path, &trace);
+  if (length < 0) {
+    fprintf(stderr, "Can't read %s\n", log_path);
+    return 1;
+  }
+  if (length == 0) {
+    fprintf(stderr, "No trace found in %s\n", log_path);
+    return 1;
+  }
+
+  shim_reset();
+  show_canvas(NULL, NULL);
+  if (image_path != NULL) {
+    init_imagedata();
+    if (!pbm_read(image_path, get_imagedata())) {
+      fprintf(stderr, "Can't read %s\n", image_path);
+      return 1;
+    }
+    redraw_imagedata(0, IMG_PIXELS);
+  }
+  shim_redraw();
+
+  uint32_t start_time = shim_now();
+  uint32_t time = start_time;
+  uint32_t batches = 0;
+  uint32_t events = 0;
+  uint32_t points = 0;
+  uint64_t frame_bytes = 0;
+  long offset = 0;
+
+  while (offset < length) {
+    const uint8_t *record = &trace[offset];
+    long size = record_size(record, length - offset);
+    if (size == 0) {
+      fprintf(stderr, "Bad trace record at byte %ld - stopping\n", offset);
+      break;
+    }
+    offset += size;
+
+    // Let time pass (and any timers fire) up to the record
+    uint16_t elapsed = get16((record[0] == TRACE_RECORD_ACCEL) ? &record[3] : &record[size - 2]);
+    shim_advance(elapsed);
+    time += elapsed;
+
+    switch (record[0]) {
+      case TRACE_RECORD_ACCEL: {
+        // The batch arrives after its last sample
+        uint32_t batch_time = time;
+        for (int i = 1; i < record[1]; i++) {
+          uint8_t gap = record[TRACE_ACCEL_HEADER_SIZE + (i * TRACE_SAMPLE_SIZE) + 6];
+          shim_advance(gap);
+          time += gap;
+        }
+        apply_accel(record, batch_time, &points);
+        batches++;
+        break;
+      }
+      case TRACE_RECORD_EVENT:
+        apply_event(record[1], record[2]);
+        events++;
+        break;
+      case TRACE_RECORD_CONFIG:
+        apply_config(record);
+        break;
+    }
+
+    // The watch redraws once the handler returns
+    uint64_t start = now_ns();
+    if (shim_redraw() > 0) {
+      add_time(STAGE_REDRAW, start);
+      frame_bytes += get_frame_bytes();
+    }
+  }
+  free(trace);
+
+  printf("%u batches, %u events, %u cursor points over %.1f s\n", batches, events, points,
+         (double)(time - start_time) / 1000);
+  printf("%-10s %8s %12s %12s %12s\n", "stage", "calls", "total ms", "avg us", "max us");
+  for (int i = 0; i < STAGE_COUNT; i++) {
+    Stage *stage = &s_stages[i];
+    printf("%-10s %8u %12.3f %12.3f %12.3f\n", stage->name, stage->calls, (double)stage->total_ns / 1e6,
+           (stage->calls > 0) ? (double)stage->total_ns / stage->calls / 1e3 : 0.0, (double)stage->max_ns / 1e3);
+  }
+  if (s_stages[STAGE_REDRAW].calls > 0)
+    printf("%.1f framebuffer bytes per redraw\n", (double)frame_bytes / s_stages[STAGE_REDRAW].calls);
+
+  if (!pbm_write(out_path, get_imagedata())) {
+    fprintf(stderr, "Can't write %s\n", out_path);
+    return 1;
+  }
+  printf("Drawing written to %s\n", out_path);
+  return 0;
+}
@@ -0,0 +1,17 @@
+#pragma once
+#include <pebble.h>
+
+// Host-only control of the Pebble shim: virtual time, window redraws and a record of the SDK
+// calls made
+
+void shim_reset(void);
+void shim_set_logging(bool enabled);
+
+uint32_t shim_call_count(const char *name);
+void shim_clear_calls(void);
+
+uint32_t shim_now(void);
+void shim_advance(uint32_t ms);
+
+int shim_redraw(void);
+GBitmap *shim_framebuffer(void);
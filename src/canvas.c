@@ -1,11 +1,17 @@
 #include "canvas.h"
 #include "common.h"
+#include "profile.h"
 #include "intmath.h"
+#include "raster.h"
+#include "undo.h"
+#include "stream.h"
+#include "heap.h"
 
 // Canvas is main window of the application that draws the image
   
 static Window *s_window;
 static Layer *s_canvaslayer;
+static Layer *s_cursorlayer;
 
 static PenStatusCallBack s_pen_event;
 static CanvaseClosedCallBack s_canvas_closed;
@@ -13,253 +19,416 @@ static CanvaseClosedCallBack s_canvas_closed;
 static bool s_drawingcursor_on = true;
 static int8_t s_pen_width = 1;
 static int s_eraser_width = 3;
-static bool s_undo_undo = false;
+static bool s_eraser_round = false;
+static const BrushStamp *s_pen_stamp;
+static const BrushStamp *s_eraser_stamp;
 static bool s_pen_down = false;
 static bool s_eraser_on = false;
 static GPoint s_cursor_loc;
-static GPoint s_last_loc;
+static GPoint s_last_loc;  // Last point drawn to
+static bool s_last_drawn = false;  // Set once the current pen/eraser is drawn at the last point
+
+// Cursor points to draw through on the next redraw (so several moves can be drawn in one frame)
+#define STROKE_QUEUE_SIZE 16
+static GPoint s_stroke_queue[STROKE_QUEUE_SIZE];
+static uint8_t s_stroke_count = 0;
 static GBitmap *s_image = NULL;
 static GBitmap *s_undo_img = NULL;
 
+// Dirty rectangle tracking. The window background is clear so the framebuffer keeps its
+// contents between frames, and only the area under last frame's cursor layer needs restoring
+static bool s_full_redraw = true;  // Set when the framebuffer no longer matches the image
+static GRect s_overlay;            // Area covered by the cursor layer last frame
+static GRect s_changed;            // Area of the image changed outside of drawing (by undo/redo)
+static uint32_t s_frame_bytes = 0; // Bytes copied from the image to the framebuffer last frame
+static uint32_t s_total_bytes = 0;
+static uint32_t s_frame_count = 0;
+static uint32_t s_show_time;       // When the canvas was shown, for timing the first frame
+
+// Rows of the image changed since it was last saved (1 bit per row)
+static uint8_t s_dirty_rows[DIRTY_ROW_BYTES];
+
 static void updatecanvas(Layer *layer, GContext *cxt);
+static void updatecursor(Layer *layer, GContext *cxt);
+static void update_cursor_layer(void);
 
 static void initialise_ui(void) {
-  s_window = window_create();
+  s_window = heap_window_create();
   window_set_fullscreen(s_window, true);
+  window_set_background_color(s_window, GColorClear);
   
   s_canvaslayer = layer_create(GRect(0, 0, 144, 168));
   layer_set_update_proc(s_canvaslayer, updatecanvas);
   layer_add_child(window_get_root_layer(s_window), s_canvaslayer);
+  
+  // Cursor/eraser outline is drawn on its own small layer above the canvas, which is moved around
+  // with the cursor so the image doesn't need redrawing when nothing is being drawn
+  s_cursorlayer = layer_create(GRect(0, 0, 0, 0));
+  layer_set_update_proc(s_cursorlayer, updatecursor);
+  layer_add_child(window_get_root_layer(s_window), s_cursorlayer);
+  update_cursor_layer();
 }
 
 static void destroy_ui(void) {
-  window_destroy(s_window);
+  heap_window_destroy(s_window);
+  layer_destroy(s_cursorlayer);
   layer_destroy(s_canvaslayer);
+  s_cursorlayer = NULL;
+  s_canvaslayer = NULL;
+}
+
+// Framebuffer may have been drawn over by another window, so redraw everything
+static void handle_window_appear(Window* window) {
+  s_full_redraw = true;
 }
 
 static void handle_window_unload(Window* window) {
+  APP_LOG(APP_LOG_LEVEL_DEBUG, "Canvas frames: %d, bytes copied: %d", (int)s_frame_count, (int)s_total_bytes);
   set_paused();
   destroy_ui();
   if (s_canvas_closed != NULL) s_canvas_closed();
   if (s_image != NULL) {
-    gbitmap_destroy(s_image);
+    heap_bitmap_destroy(s_image);
     s_image = NULL;
   }
   if (s_undo_img != NULL) {
-    gbitmap_destroy(s_undo_img);
+    heap_bitmap_destroy(s_undo_img);
     s_undo_img = NULL;
   }
+  undo_reset();
 }
 
-// Draw line with width
-// (Based on code found here http://rosettacode.org/wiki/Bitmap/Bresenham's_line_algorithm#C)
-static void graphics_draw_line2(GContext *ctx, GPoint p0, GPoint p1, int8_t width) {
-  // Order points so that lower x is first
-  int16_t x0, x1, y0, y1;
-  if (p0.x <= p1.x) {
-    x0 = p0.x; x1 = p1.x; y0 = p0.y; y1 = p1.y;
-  } else {
-    x0 = p1.x; x1 = p0.x; y0 = p1.y; y1 = p0.y;
-  }
+// Smallest rectangle containing both rectangles (empty rectangles are ignored)
+static GRect grect_union(GRect a, GRect b) {
+  if (a.size.w <= 0 || a.size.h <= 0) return b;
+  if (b.size.w <= 0 || b.size.h <= 0) return a;
   
-  // Init loop variables
-  int16_t dx = x1-x0;
-  int16_t dy = abs(y1-y0);
-  int16_t sy = y0<y1 ? 1 : -1; 
-  int16_t err = (dx>dy ? dx : -dy)/2;
-  int16_t e2;
+  int16_t x0 = a.origin.x < b.origin.x ? a.origin.x : b.origin.x;
+  int16_t y0 = a.origin.y < b.origin.y ? a.origin.y : b.origin.y;
+  int16_t x1 = (a.origin.x + a.size.w) > (b.origin.x + b.size.w) ? (a.origin.x + a.size.w) : (b.origin.x + b.size.w);
+  int16_t y1 = (a.origin.y + a.size.h) > (b.origin.y + b.size.h) ? (a.origin.y + a.size.h) : (b.origin.y + b.size.h);
+  return GRect(x0, y0, x1 - x0, y1 - y0);
+}
+
+// Clip rectangle to the image bounds
+static GRect grect_clip_to_image(GRect r) {
+  int16_t x0 = r.origin.x < 0 ? 0 : r.origin.x;
+  int16_t y0 = r.origin.y < 0 ? 0 : r.origin.y;
+  int16_t x1 = (r.origin.x + r.size.w) > IMG_WIDTH ? IMG_WIDTH : (r.origin.x + r.size.w);
+  int16_t y1 = (r.origin.y + r.size.h) > IMG_HEIGHT ? IMG_HEIGHT : (r.origin.y + r.size.h);
+  if (x1 <= x0 || y1 <= y0) return GRect(0, 0, 0, 0);
+  return GRect(x0, y0, x1 - x0, y1 - y0);
+}
+
+// Mark the rows of a rectangle as changed since the image was saved
+static void mark_rows_dirty(GRect rect) {
+  rect = grect_clip_to_image(rect);
+  for (int16_t y = rect.origin.y; y < rect.origin.y + rect.size.h; y++)
+    s_dirty_rows[y / 8] |= 1 << (y % 8);
+}
+
+// Rectangle centered on a point (used for brush and cursor areas)
+static GRect grect_around(GPoint p, int16_t radius) {
+  return GRect(p.x - radius, p.y - radius, (radius * 2) + 1, (radius * 2) + 1);
+}
+
+// Copy the bytes covering a rectangle from the image to the framebuffer, or fill them white if
+// there is no image. Returns the number of bytes copied
+static uint32_t copy_rect(uint8_t *dest, const uint8_t *src, GRect rect) {
+  rect = grect_clip_to_image(rect);
+  if (rect.size.w == 0) return 0;
   
-  // Calculate whether line thickness will be added vertically or horizontally based on line angle
-  int8_t xdiff, ydiff;
+  // Pixels are 1 bit each, so copy whole bytes that contain the rectangle columns
+  int16_t first = rect.origin.x / 8;
+  int16_t len = ((rect.origin.x + rect.size.w - 1) / 8) - first + 1;
   
-  if (dx > dy) {
-    xdiff = 0;
-    ydiff = width/2;
-  } else {
-    xdiff = width/2;
-    ydiff = 0;
+  for (int16_t y = rect.origin.y; y < rect.origin.y + rect.size.h; y++) {
+    int16_t offset = (y * IMG_ROW_BYTES) + first;
+    if (src != NULL)
+      memcpy(dest + offset, src + offset, len);
+    else
+      memset(dest + offset, 0xFF, len);
   }
   
-  // Use Bresenham's integer algorithm, with slight modification for line width, to draw line at any angle
-  while (true) {
-    // Draw line thickness at each point by drawing another line 
-    // (horizontally when > +/-45 degrees, vertically when <= +/-45 degrees)
-    graphics_draw_line(ctx, GPoint(x0-xdiff, y0-ydiff), GPoint(x0+xdiff, y0+ydiff));
+  return len * rect.size.h;
+}
+
+// Draw the line/eraser from the last point to a new point straight into the image,
+// returning the area changed
+static GRect draw_segment(uint8_t *image, GPoint from, GPoint to) {
+  if (s_pen_down) {
+    if (abs(to.x-from.x) > 1 || abs(to.y-from.y) > 1)
+      // Draw line (with thickness and round ends) between last and current cursor position if it jumps more than 1 pixel
+      raster_draw_capsule(image, from, to, s_pen_width/2, GColorBlack);
+    else
+      // Stamp the round pen brush at the current cursor point
+      raster_stamp(image, s_pen_stamp, to, GColorBlack);
+    stream_segment(from, to, false, false, s_pen_width);
     
-    if (x0==x1 && y0==y1) break;
-    e2 = err;
-    if (e2 >-dx) { err -= dy; x0++; }
-    if (e2 < dy) { err += dx; y0 += sy; }
+    int16_t radius = (s_pen_width / 2) + 1;
+    return grect_union(grect_around(from, radius), grect_around(to, radius));
+  } else {
+    // Stamp a WxW white square/circle to 'erase' the current location
+    raster_stamp(image, s_eraser_stamp, to, GColorWhite);
+    stream_segment(from, to, true, s_eraser_round, s_eraser_width);
+    return grect_around(to, (s_eraser_width / 2) + 1);
   }
 }
 
+// Draw through all the queued cursor points, returning the area of the image changed
+static GRect draw_stroke(void) {
+  // Create bitmap to store the drawn image
+  init_imagedata();
+  if (s_image == NULL) return GRect(0, 0, 0, 0);
+  
+  uint8_t *image = s_image->addr;
+  GRect changed;
+  
+  if (s_stroke_count == 0) {
+    // Cursor hasn't moved, so just draw at the cursor point (once, as redrawing it changes nothing
+    // and would stream the same point again every frame)
+    if (s_last_drawn) return GRect(0, 0, 0, 0);
+    changed = draw_segment(image, s_cursor_loc, s_cursor_loc);
+  } else {
+    changed = GRect(0, 0, 0, 0);
+    for (uint8_t i = 0; i < s_stroke_count; i++) {
+      changed = grect_union(changed, draw_segment(image, s_last_loc, s_stroke_queue[i]));
+      s_last_loc = s_stroke_queue[i];
+    }
+    s_stroke_count = 0;
+  }
+  
+  s_last_drawn = true;
+  return changed;
+}
+
 // Handle canvas layer being redrawn (which also does the image drawing)
 static void updatecanvas(Layer *layer, GContext *ctx) {
+  profile_start(PROFILE_REDRAW);
+  s_frame_bytes = 0;
   
-  // If there is an image in memory, copy it back to the screen (since it clears every time this proc is called)
-  if (s_image != NULL) {
+  // The framebuffer keeps last frame's pixels, so it matches the image except under the old cursor
+  // and where the image is drawn on. Draw into the image first, then copy just those areas
+  // (or everything if the framebuffer was drawn over)
+  GRect blit = grect_union(s_overlay, s_changed);
+  s_changed = GRect(0, 0, 0, 0);
+  
+  if (s_pen_down || s_eraser_on) {
+    GRect drawn = draw_stroke();
+    mark_rows_dirty(drawn);
+    blit = grect_union(blit, drawn);
+  }
+  
+  if (s_full_redraw) blit = GRect(0, 0, IMG_WIDTH, IMG_HEIGHT);
+  
+  if (blit.size.w > 0) {
     // Access framebuffer directly to get pixel data
     GBitmap *screen = graphics_capture_frame_buffer(ctx);
       
     if (screen != NULL) {
-      // Pebble screen (144x168) uses 20 bytes per row, so copy 20x168 bytes of the bitmap data
-      // from the drawn image back to the framebuffer
-      memcpy(screen->addr, s_image->addr, IMG_PIXELS);
-      graphics_release_frame_buffer(ctx, screen); // Must release for line draw to work
+      // Pebble screen (144x168) uses 20 bytes per row, so copy the bytes covering the changed area
+      // from the drawn image to the framebuffer (blank image is white)
+      s_frame_bytes += copy_rect(screen->addr, (s_image != NULL) ? s_image->addr : NULL, blit);
+      graphics_release_frame_buffer(ctx, screen); // Must release for cursor draw to work
+      s_full_redraw = false;
     }
   }
   
-  if (s_pen_down || s_eraser_on) {
-    if (s_pen_down) {
-      // Pen is down, so use graphics routines to draw to the framebuffer (which will then be copied to save image)
-      graphics_context_set_stroke_color(ctx, GColorBlack);
-      if (s_pen_width == 1) {
-        if (abs(s_cursor_loc.x-s_last_loc.x) > 1 || abs(s_cursor_loc.y-s_last_loc.y) > 1)
-          // Draw line between last and current cursor position if it jumps more than 1 pixel
-          graphics_draw_line(ctx, s_last_loc, s_cursor_loc);
-        else
-          graphics_draw_pixel(ctx, s_cursor_loc);
-      } else {
-        graphics_context_set_fill_color(ctx, GColorBlack);
-          
-        if (abs(s_cursor_loc.x-s_last_loc.x) > 1 || abs(s_cursor_loc.y-s_last_loc.y) > 1)
-          // Draw line (with thickness) between last and current cursor position if it jumps more than 1 pixel
-          graphics_draw_line2(ctx, s_last_loc, s_cursor_loc, s_pen_width);
-
-        // Round end of line/current cursor point
-        graphics_fill_circle(ctx, s_cursor_loc, s_pen_width/2);
-      }
-    } else if (s_eraser_on) {
-      // Draw a WxW white square to 'erase' the current location
-      graphics_context_set_fill_color(ctx, GColorWhite);
-      graphics_fill_rect(ctx, GRect(s_cursor_loc.x-(s_eraser_width/2), s_cursor_loc.y-(s_eraser_width/2), s_eraser_width, s_eraser_width), 0, GCornerNone);
-    }
-    
-    // Create bitmap to store framebuffer pixel data after drawing line
-    init_imagedata();
-    
-    if (s_image != NULL) {
-      // Access framebuffer directly to copy the updated pixels back to the bitmap
-      GBitmap *screen = graphics_capture_frame_buffer(ctx);
-      
-      if (screen != NULL) {
-        // Pebble screen (144x168) uses 20 bytes per row, so copy 20x168 bytes of the bitmap data
-        // from the framebuffer to save the drawn image
-        memcpy(s_image->addr, screen->addr, IMG_PIXELS);
-        graphics_release_frame_buffer(ctx, screen);
-      }
-    }
-  }
+  // Cursor layer is drawn next and records where it draws
+  s_overlay = GRect(0, 0, 0, 0);
   
-  // If drawing cursor on or pen is not down, draw a cursor over the image
-  if ((s_drawingcursor_on || !s_pen_down) && !s_eraser_on) {
-    graphics_context_set_stroke_color(ctx, GColorBlack);
+  if (s_frame_count == 0)
+    APP_LOG(APP_LOG_LEVEL_DEBUG, "First frame drawn after %d ms", (int)(get_time_ms() - s_show_time));
+  
+  s_total_bytes += s_frame_bytes;
+  s_frame_count++;
+  profile_end(PROFILE_REDRAW);
+}
+
+// Handle cursor layer being redrawn (over the canvas, in coordinates relative to the cursor area)
+static void updatecursor(Layer *layer, GContext *ctx) {
+  GRect frame = layer_get_frame(layer);
+  GPoint center = GPoint(frame.size.w / 2, frame.size.h / 2);
+  
+  graphics_context_set_stroke_color(ctx, GColorBlack);
+  
+  if (s_eraser_on) {
+    // If erasing, draw a square/circle outline to show where the erasor is
+    if (s_eraser_round)
+      graphics_draw_circle(ctx, center, s_eraser_width / 2);
+    else
+      graphics_draw_rect(ctx, GRect(0, 0, s_eraser_width, s_eraser_width));
+  } else {
+    // Otherwise draw a cross-hair cursor over the image
     graphics_context_set_compositing_mode(ctx, GCompOpAssignInverted);
-    graphics_draw_line(ctx, GPoint(s_cursor_loc.x, s_cursor_loc.y - 5), GPoint(s_cursor_loc.x, s_cursor_loc.y + 5));
-    graphics_draw_line(ctx, GPoint(s_cursor_loc.x - 5, s_cursor_loc.y), GPoint(s_cursor_loc.x + 5, s_cursor_loc.y));
+    graphics_draw_line(ctx, GPoint(center.x, center.y - 5), GPoint(center.x, center.y + 5));
+    graphics_draw_line(ctx, GPoint(center.x - 5, center.y), GPoint(center.x + 5, center.y));
   }
   
-  // If erasing, draw a 3x3 square outline to show where the erasor is
-  if (s_eraser_on) {
-    graphics_context_set_stroke_color(ctx, GColorBlack);
-    graphics_draw_rect(ctx, GRect(s_cursor_loc.x-(s_eraser_width/2), s_cursor_loc.y-(s_eraser_width/2), s_eraser_width, s_eraser_width));
+  // Let the canvas know which area to restore next frame
+  s_overlay = frame;
+}
+
+// Move/show/hide the cursor layer to match the cursor location and drawing state
+static void update_cursor_layer(void) {
+  if (s_cursorlayer == NULL) return;
+  
+  // If drawing cursor on or pen is not down, show the cursor (or show the eraser outline)
+  bool visible = s_eraser_on || s_drawingcursor_on || !s_pen_down;
+  layer_set_hidden(s_cursorlayer, !visible);
+  
+  if (visible) {
+    layer_set_frame(s_cursorlayer, grect_around(s_cursor_loc, s_eraser_on ? (s_eraser_width / 2) : 5));
+    layer_mark_dirty(s_cursorlayer);
   }
 }
 
+// Bytes copied from the image to the framebuffer in the last frame (for measuring redraw cost)
+uint32_t get_frame_bytes(void) {
+  return s_frame_bytes;
+}
+
 // Turns cursor while drawing on/off
 void set_drawingcursor(bool cursor_on) {
   s_drawingcursor_on = cursor_on;
-  layer_mark_dirty(s_canvaslayer);
+  update_cursor_layer();
 }
 
+// Sets the pen width and selects its precomputed brush
 void set_penwith(int width) {
   s_pen_width = width;
+  s_pen_stamp = get_round_stamp(width);
+  s_last_drawn = false;
 }
 
+// Sets the eraser width and selects its precomputed brush
 void set_eraserwidth(int width) {
   s_eraser_width = width;
+  s_eraser_stamp = s_eraser_round ? get_round_stamp(width) : get_square_stamp(width);
+  s_last_drawn = false;
+  update_cursor_layer();
 }
 
-void set_undo_undo(bool undo_undo) {
-  s_undo_undo = undo_undo;
+// Sets the eraser to a round or square brush
+void set_erasershape(bool round) {
+  s_eraser_round = round;
+  set_eraserwidth(s_eraser_width);
 }
 
-// Save the current image for undo
-static void save_undo(void) {
+// Save the current image as the start of a drawing/erasing session that can be undone
+static void start_undo(void) {
+  // Drawing creates the image anyway, so create it now to have a blank image to undo back to
+  init_imagedata();
   
   if (s_image != NULL) {
     if (s_undo_img == NULL)
-      s_undo_img = gbitmap_create_blank(GSize(IMG_WIDTH, IMG_HEIGHT));
+      s_undo_img = heap_bitmap_create(GSize(IMG_WIDTH, IMG_HEIGHT));
     
-    memcpy(s_undo_img->addr, s_image->addr, IMG_PIXELS);
-  } else {
-    // No image, so make sure there is no undo
-    if (s_undo_img != NULL) {
-      gbitmap_destroy(s_undo_img);
-      s_undo_img = NULL;
-    }
+    if (s_undo_img != NULL)
+      memcpy(s_undo_img->addr, s_image->addr, IMG_PIXELS);
+  }
+}
+
+// End the drawing/erasing session, storing its changes in the undo history.
+// (Drawing changes the image in place, so the full copy from the start of the session is needed to
+// find what changed. The history frees it, unless the changes were too many to encode)
+static void end_undo(void) {
+  if (s_undo_img != NULL) {
+    if (s_image != NULL)
+      undo_push(s_undo_img, s_image->addr);
+    else
+      heap_bitmap_destroy(s_undo_img);
+    s_undo_img = NULL;
   }
 }
 
-// Indicates if an undo is saved
+// Indicates if an undo is saved (including the current drawing/erasing session)
 bool has_undo(void) {
-  return (s_undo_img != NULL);
+  return (s_undo_img != NULL) || undo_can_undo();
+}
+
+// Indicates if an undone change can be redone (a new session replaces any redo)
+bool has_redo(void) {
+  return (s_undo_img == NULL) && undo_can_redo();
 }
 
 // Roll back the image to the last undo
 void undo_image(void) {
-  if (has_undo()) {
-    GBitmap *prev_img = NULL;
-    if (s_undo_undo) {
-      // If set to undo the undo, temporarily save the image before undoing
-      prev_img = gbitmap_create_blank(GSize(IMG_WIDTH, IMG_HEIGHT));
-      memcpy(prev_img->addr, s_image->addr, IMG_PIXELS);
-    }
-    
-    // Roll back to the last undo
-    memcpy(s_image->addr, s_undo_img->addr, IMG_PIXELS);
+  // Stop drawing so the current session is stored in the undo history
+  set_paused();
+  
+  if (undo_can_undo() && s_image != NULL) {
+    GRect changed = undo_step_back(s_image->addr);
+    mark_rows_dirty(changed);
+    stream_resync();
+    s_changed = grect_union(s_changed, changed);
     
-    if (s_undo_undo && prev_img != NULL) {
-      // If set to undo the undo, set the undo image to the image before undoing
-      memcpy(s_undo_img->addr, prev_img->addr, IMG_PIXELS);
-      gbitmap_destroy(prev_img);
-    } else {
-      // Else dispose the undo image
-      gbitmap_destroy(s_undo_img);
-      s_undo_img = NULL;
-    }
+    vibes_short_pulse();
+    layer_mark_dirty(s_canvaslayer);
+    heap_log("undo");
+  }
+}
+
+// Re-apply the last undone change (undo the undo)
+void redo_image(void) {
+  set_paused();
+  
+  if (undo_can_redo() && s_image != NULL) {
+    GRect changed = undo_step_forward(s_image->addr);
+    mark_rows_dirty(changed);
+    stream_resync();
+    s_changed = grect_union(s_changed, changed);
     
     vibes_short_pulse();
     layer_mark_dirty(s_canvaslayer);
+    heap_log("redo");
   }
 }
 
 // Toggles 'pen' (drawing) on/off (down/up)
 void toggle_pen(void) {
-  if (s_eraser_on)
+  if (s_eraser_on) {
     s_eraser_on = false;
-  else {
+    end_undo();
+  } else {
     // If about to turn the drawing on, save the current image for undoing
-    if (!s_pen_down)
-      save_undo();
+    // (and start the line at the cursor rather than where it was before the last move)
+    if (!s_pen_down) {
+      start_undo();
+      s_last_loc = s_cursor_loc;
+      s_stroke_count = 0;
+      s_last_drawn = false;
+    } else {
+      end_undo();
+    }
     
     s_pen_down = !s_pen_down;
   }
   
+  update_cursor_layer();
   layer_mark_dirty(s_canvaslayer);
   if (s_pen_event != NULL) s_pen_event(s_pen_down, s_eraser_on);
 }
 
 // Toggles 'eraser' on/off
 void toggle_eraser(void) {
-  if (s_pen_down)
+  if (s_pen_down) {
     s_pen_down = false;
+    end_undo();
+  }
   
   // If about to turn erasor on, save the current image for undoing
-  if (!s_eraser_on) 
-    save_undo();
+  if (!s_eraser_on) {
+    start_undo();
+    s_last_loc = s_cursor_loc;
+    s_stroke_count = 0;
+    s_last_drawn = false;
+  } else {
+    end_undo();
+  }
   
   s_eraser_on = !s_eraser_on;
+  update_cursor_layer();
   layer_mark_dirty(s_canvaslayer);
   if (s_pen_event != NULL) s_pen_event(s_pen_down, s_eraser_on);
 }
@@ -269,10 +438,17 @@ bool is_pen_down(void) {
   return s_pen_down;
 }
 
+// Gets whether the 'eraser' is on
+bool is_eraser_on(void) {
+  return s_eraser_on;
+}
+
 // Pauses drawing by setting 'pen' up
 void set_paused(void) {
   s_pen_down = false;
   s_eraser_on = false;
+  end_undo();
+  update_cursor_layer();
   if (s_pen_event != NULL) s_pen_event(s_pen_down, s_eraser_on);
 }
 
@@ -289,16 +465,68 @@ void* get_imagedata(void) {
 
 // Initializes bitmap that stores the image data
 void init_imagedata(void) {
-  if (s_image == NULL)
-    s_image = gbitmap_create_blank(GSize(IMG_WIDTH, IMG_HEIGHT));
+  if (s_image == NULL) {
+    s_image = heap_bitmap_create(GSize(IMG_WIDTH, IMG_HEIGHT));
+    // Drawing only touches the pixels it changes, so start with a white image
+    if (s_image != NULL) memset(s_image->addr, 0xFF, IMG_PIXELS);
+  }
+}
+
+// Moves the cursor through a series of locations, updating the screen once
+// (if 'pen' is down this will draw a line through all of them)
+void cursor_set_path(const GPoint *path, uint8_t count) {
+  bool moved = false;
+  
+  for (uint8_t i = 0; i < count; i++) {
+    GPoint loc = path[i];
+    if (loc.x == s_cursor_loc.x && loc.y == s_cursor_loc.y) continue;
+    
+    s_cursor_loc = loc;
+    moved = true;
+    
+    if (s_pen_down || s_eraser_on) {
+      // Queue the point for drawing (if the redraw is falling behind, replace the last point)
+      if (s_stroke_count == STROKE_QUEUE_SIZE) {
+        s_stroke_count--;
+        profile_point_dropped();
+      }
+      s_stroke_queue[s_stroke_count++] = loc;
+    }
+  }
+  
+  if (moved) {
+    // If the cursor location has changed, move the cursor
+    update_cursor_layer();
+    
+    // Only redraw the canvas when drawing. (The window still redraws all its layers, but the
+    // canvas then only has to restore the small area under the cursor's old location)
+    if (s_pen_down || s_eraser_on) {
+      profile_frame_requested();
+      layer_mark_dirty(s_canvaslayer);
+    }
+  }
 }
 
 // Updates the cursor location (if 'pen' is down this will draw on the screen)
 void cursor_set_loc(GPoint loc) {
-  if (loc.x != s_cursor_loc.x || loc.y != s_cursor_loc.y) {
-    // If the cursor location has changed, update the screen
-    s_last_loc = s_cursor_loc;
-    s_cursor_loc = loc;
+  cursor_set_path(&loc, 1);
+}
+
+// Discards the image data and its undo history (e.g. when switching to another drawing)
+void reset_image(void) {
+  if (s_image != NULL) {
+    heap_bitmap_destroy(s_image);
+    s_image = NULL;
+    // Undo history only applies to the image it was recorded on
+    if (s_undo_img != NULL) {
+      heap_bitmap_destroy(s_undo_img);
+      s_undo_img = NULL;
+    }
+    undo_reset();
+    stream_resync();
+    s_last_drawn = false;
+    mark_rows_dirty(GRect(0, 0, IMG_WIDTH, IMG_HEIGHT));
+    s_full_redraw = true;
     layer_mark_dirty(s_canvaslayer);
   }
 }
@@ -306,11 +534,45 @@ void cursor_set_loc(GPoint loc) {
 // Clears the image data and updates the screen
 void clear_image(void) {
   if (s_image != NULL) {
-    gbitmap_destroy(s_image);
-    s_image = NULL;
+    reset_image();
     vibes_double_pulse();
-    layer_mark_dirty(s_canvaslayer);
+    heap_log("clear");
+  }
+}
+
+// Redraws a range of the image (e.g. after it was loaded)
+void redraw_imagedata(uint16_t offset, uint16_t length) {
+  if (length == 0) return;
+  
+  int16_t y = offset / IMG_ROW_BYTES;
+  s_changed = grect_union(s_changed, GRect(0, y, IMG_WIDTH, ((offset + length - 1) / IMG_ROW_BYTES) - y + 1));
+  s_last_drawn = false;
+  layer_mark_dirty(s_canvaslayer);
+}
+
+// Indicates if any image bytes in a range have changed since the image was last saved
+bool is_imagedata_dirty(uint16_t offset, uint16_t length) {
+  if (length == 0) return false;
+  
+  for (int16_t y = offset / IMG_ROW_BYTES; y <= (offset + length - 1) / IMG_ROW_BYTES && y < IMG_HEIGHT; y++) {
+    if (s_dirty_rows[y / 8] & (1 << (y % 8))) return true;
   }
+  return false;
+}
+
+// Indicates if the image has changed since it was last saved
+bool has_dirty_imagedata(void) {
+  return is_imagedata_dirty(0, IMG_PIXELS);
+}
+
+// Marks the image as saved (or just loaded)
+void clear_dirty_imagedata(void) {
+  memset(s_dirty_rows, 0, sizeof(s_dirty_rows));
+}
+
+// Marks the whole image as needing to be saved
+void mark_imagedata_dirty(void) {
+  memset(s_dirty_rows, 0xFF, sizeof(s_dirty_rows));
 }
 
 // Indicates if the canvas window is on top of the stack (is displaying)
@@ -328,12 +590,16 @@ void init_click_events(ClickConfigProvider click_config_provider) {
 
 // Initialize and show the main window with event callbacks
 void show_canvas(PenStatusCallBack pen_event, CanvaseClosedCallBack closed_event) {
+  s_show_time = get_time_ms();
   s_pen_event = pen_event;
   s_canvas_closed = closed_event;
   s_cursor_loc = GPoint((IMG_WIDTH/2), (IMG_HEIGHT/2));
   s_last_loc = s_cursor_loc;
+  set_penwith(s_pen_width);
+  set_eraserwidth(s_eraser_width);
   initialise_ui();
   window_set_window_handlers(s_window, (WindowHandlers) {
+    .appear = handle_window_appear,
     .unload = handle_window_unload,
   });
   window_stack_push(s_window, true);
@@ -6,19 +6,30 @@ typedef void (*PenStatusCallBack)(bool pen_down, bool erasor_on);
 void set_drawingcursor(bool cursor_on);
 void set_penwith(int width);
 void set_eraserwidth(int width);
-void set_undo_undo(bool undo_undo);
+void set_erasershape(bool round);
 bool has_undo(void);
+bool has_redo(void);
 void undo_image(void);
+void redo_image(void);
 void toggle_pen(void);
 void toggle_eraser(void);
 bool is_pen_down(void);
+bool is_eraser_on(void);
 void set_paused(void);
 void cursor_set_loc(GPoint loc);
+void cursor_set_path(const GPoint *path, uint8_t count);
 void clear_image(void);
+void reset_image(void);
 bool is_canvas_on_top();
+uint32_t get_frame_bytes(void);
 
 void* get_imagedata(void);
 void init_imagedata(void);
+bool is_imagedata_dirty(uint16_t offset, uint16_t length);
+bool has_dirty_imagedata(void);
+void clear_dirty_imagedata(void);
+void mark_imagedata_dirty(void);
+void redraw_imagedata(uint16_t offset, uint16_t length);
 
 void init_click_events(ClickConfigProvider click_config_provider);
 void show_canvas(PenStatusCallBack pen_event, CanvaseClosedCallBack closed_event);
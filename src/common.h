@@ -8,8 +8,24 @@
 #define APP_LOG(...)
 #endif
 
+// Log accelerometer batches and button presses for replaying on the host (see trace.c)
+//#define TRACE
+#ifndef DEBUG
+#undef TRACE
+#endif
+
 
 #define IMG_WIDTH 144
 #define IMG_HEIGHT 168
 #define IMG_ROW_BYTES 20
 #define IMG_PIXELS IMG_ROW_BYTES*IMG_HEIGHT
+#define PERSIST_SIZE_MAX 256
+#define DIRTY_ROW_BYTES ((IMG_HEIGHT + 7) / 8)
+
+// Current time in milliseconds (wraps around, so only use for measuring time differences)
+static inline uint32_t get_time_ms(void) {
+  time_t seconds;
+  uint16_t ms;
+  time_ms(&seconds, &ms);
+  return ((uint32_t)seconds * 1000) + ms;
+}
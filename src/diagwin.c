@@ -0,0 +1,62 @@
+#include <pebble.h>
+#include "diagwin.h"
+#include "profile.h"
+#include "heap.h"
+
+#ifdef DEBUG
+
+// Window showing the profiler counters and heap use (debug builds only). They are also written
+// to the log each time it is shown. The text is longer than the screen, so it scrolls with the
+// Up and Down buttons
+  
+#define MAX_TEXT_HEIGHT 500
+  
+static Window *s_window;
+static ScrollLayer *s_scroll_layer;
+static TextLayer *s_text_layer;
+static char s_text[512];
+
+static void initialise_ui(void) {
+  s_window = heap_window_create();
+  window_set_fullscreen(s_window, true);
+  
+  s_scroll_layer = scroll_layer_create(GRect(0, 0, 144, 168));
+  scroll_layer_set_click_config_onto_window(s_scroll_layer, s_window);
+  layer_add_child(window_get_root_layer(s_window), scroll_layer_get_layer(s_scroll_layer));
+  
+  s_text_layer = text_layer_create(GRect(2, 0, 140, MAX_TEXT_HEIGHT));
+  text_layer_set_font(s_text_layer, fonts_get_system_font(FONT_KEY_GOTHIC_14));
+  scroll_layer_add_child(s_scroll_layer, (Layer *)s_text_layer);
+}
+
+static void destroy_ui(void) {
+  heap_window_destroy(s_window);
+  scroll_layer_destroy(s_scroll_layer);
+  text_layer_destroy(s_text_layer);
+  s_window = NULL;
+}
+
+static void handle_window_unload(Window* window) {
+  destroy_ui();
+}
+
+void show_diagwin(void) {
+  profile_log();
+  heap_log("diagnostics");
+  profile_format(s_text, sizeof(s_text));
+  int len = strlen(s_text);
+  snprintf(s_text + len, sizeof(s_text) - len, "\nHeap used: %d\nHeap peak: %d\nHeap free: %d", 
+           (int)heap_live_bytes(), (int)heap_peak_bytes(), (int)heap_bytes_free());
+  
+  initialise_ui();
+  text_layer_set_text(s_text_layer, s_text);
+  // Scroll just as far as the text goes (plus a little space at the bottom)
+  GSize size = text_layer_get_content_size(s_text_layer);
+  scroll_layer_set_content_size(s_scroll_layer, GSize(144, size.h + 4));
+  window_set_window_handlers(s_window, (WindowHandlers) {
+    .unload = handle_window_unload,
+  });
+  window_stack_push(s_window, true);
+}
+
+#endif
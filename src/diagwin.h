@@ -0,0 +1,7 @@
+#pragma once
+#include <pebble.h>
+#include "common.h"
+
+#ifdef DEBUG
+void show_diagwin(void);
+#endif
@@ -0,0 +1,68 @@
+#include <pebble.h>
+#include "filter.h"
+#include "intmath.h"
+
+// Fixed-point (Q16) accelerometer smoothing filters, so no floating point library calls are needed
+// on the watch. The fixed filter is a single pole IIR: value += alpha * (sample - value), with
+// alpha = period / (time constant + period).
+// The adaptive filter (a One Euro filter, see http://cristal.univ-lille.fr/~casiez/1euro/) raises
+// the cut-off frequency as the (smoothed) rate of change goes up, so slow movements are smoothed
+// heavily to remove jitter while fast movements have little lag.
+// On synthetic accelerometer data both filters stay within 1 unit of an exact (double) filter with
+// the same coefficients, while the previous float filter (FILTER_K 0.9, truncated to int every step)
+// was off by up to 7 units (checked by the accuracy-filter cases in host/bench.c)
+
+#define TWO_PI_Q16 411775     // 2 * pi in Q16
+#define ADAPTIVE_BETA 2       // Cut-off frequency increase (in mHz) per unit/second of rate of change
+#define RATE_CUTOFF_HZ 1      // Cut-off frequency for smoothing the rate of change
+
+static FilterMode s_mode = FILTER_FIXED;
+static uint16_t s_period_ms = 100;
+static int32_t s_alpha;        // Fixed filter coefficient (Q16)
+static int32_t s_min_omega;    // Adaptive filter minimum 2*pi*cutoff*period (Q16)
+static int32_t s_omega_step;   // 2*pi*period (Q16) for converting cut-off frequency
+static int32_t s_rate_alpha;   // Rate of change filter coefficient (Q16)
+
+// Filter coefficient for a given 2*pi*cutoff*period (Q16)
+static int32_t omega_to_alpha(int32_t omega) {
+  return (int32_t)(((int64_t)omega << 16) / (Q16_ONE + omega));
+}
+
+// Set the filter type, time constant (for the minimum cut-off frequency), and time between samples
+void filter_configure(FilterMode mode, uint16_t time_constant_ms, uint16_t sample_period_ms) {
+  s_mode = mode;
+  s_period_ms = sample_period_ms > 0 ? sample_period_ms : 1;
+  
+  // period / time constant is the same as 2*pi*cutoff*period with cutoff = 1/(2*pi*time constant)
+  s_min_omega = ((int32_t)s_period_ms << 16) / (time_constant_ms > 0 ? time_constant_ms : 1);
+  s_alpha = omega_to_alpha(s_min_omega);
+  
+  s_omega_step = (int32_t)(((int64_t)TWO_PI_Q16 * s_period_ms) / 1000);
+  s_rate_alpha = omega_to_alpha(s_omega_step * RATE_CUTOFF_HZ);
+}
+
+// Start filtering from a value
+void filter_reset(AxisFilter *filter, int32_t value) {
+  filter->value = value << 16;
+  filter->rate = 0;
+}
+
+// Filter the next sample, returning the (rounded) filtered value
+int32_t filter_update(AxisFilter *filter, int32_t sample) {
+  int32_t diff = (sample << 16) - filter->value;
+  int32_t alpha = s_alpha;
+  
+  if (s_mode == FILTER_ADAPTIVE) {
+    // Smooth the rate of change (units per second)
+    int32_t rate = (int32_t)(((int64_t)diff * 1000 / s_period_ms) >> 16);
+    filter->rate += (int32_t)(((int64_t)s_rate_alpha * (rate - filter->rate)) >> 16);
+    
+    // Cut-off = minimum + beta * |rate|
+    int32_t omega = s_min_omega + (int32_t)(((int64_t)s_omega_step * ADAPTIVE_BETA * abs(filter->rate)) / 1000);
+    alpha = omega_to_alpha(omega);
+  }
+  
+  filter->value += (int32_t)(((int64_t)alpha * diff) >> 16);
+  
+  return (filter->value + (1 << 15)) >> 16;
+}
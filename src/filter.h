@@ -0,0 +1,17 @@
+#pragma once
+#include <pebble.h>
+
+typedef enum FilterMode {
+  FILTER_FIXED = 0,     // Single pole low-pass with a fixed time constant
+  FILTER_ADAPTIVE = 1   // Smooths more when still and less when moving fast (One Euro filter)
+} FilterMode;
+
+// Filter state for one accelerometer axis
+typedef struct {
+  int32_t value;  // Filtered value (Q16 fixed-point)
+  int32_t rate;   // Filtered rate of change per second (adaptive filter only)
+} AxisFilter;
+
+void filter_configure(FilterMode mode, uint16_t time_constant_ms, uint16_t sample_period_ms);
+void filter_reset(AxisFilter *filter, int32_t value);
+int32_t filter_update(AxisFilter *filter, int32_t sample);
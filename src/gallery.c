@@ -0,0 +1,172 @@
+#include <pebble.h>
+#include "gallery.h"
+#include "imgcodec.h"
+#include "heap.h"
+
+// Gallery window for switching between saved drawings, using a menu layer with a thumbnail
+// of each drawing (thumbnails are stored separately so the full images are never loaded)
+
+#define MENU_NEW_ITEM 0
+#define NEW_CELL_HEIGHT 44
+#define THUMB_CELL_HEIGHT (THUMB_HEIGHT + 4)
+#define NO_DRAWING -1
+  
+static struct Gallery_st *s_gallery; // Gallery index passed from main unit
+static GalleryOpenCallBack s_open_event;
+static GalleryDeleteCallBack s_delete_event;
+static GalleryThumbCallBack s_thumb_event;
+
+static Window *s_window;
+static MenuLayer *gallery_layer;
+static GBitmap *s_thumb_bitmap;         // Bitmap each thumbnail is drawn from
+static uint8_t s_thumb[THUMB_BYTES];    // Thumbnail data read from storage
+static int s_delete_index = NO_DRAWING; // Drawing waiting for a second long press to be deleted
+
+static void initialise_ui(void) {
+  s_window = heap_window_create();
+  window_set_fullscreen(s_window, false);
+  
+  // gallery_layer
+  gallery_layer = menu_layer_create(GRect(0, 0, 144, 152));
+  menu_layer_set_click_config_onto_window(gallery_layer, s_window);
+  layer_add_child(window_get_root_layer(s_window), (Layer *)gallery_layer);
+  
+  s_thumb_bitmap = heap_bitmap_create(GSize(THUMB_WIDTH, THUMB_HEIGHT));
+}
+
+static void destroy_ui(void) {
+  heap_window_destroy(s_window);
+  menu_layer_destroy(gallery_layer);
+  if (s_thumb_bitmap != NULL) {
+    heap_bitmap_destroy(s_thumb_bitmap);
+    s_thumb_bitmap = NULL;
+  }
+}
+
+// Set menu section count
+static uint16_t menu_get_num_sections_callback(MenuLayer *menu_layer, void *data) {
+  return 1;
+}
+
+// Set menu item count (new drawing item followed by the saved drawings)
+static uint16_t menu_get_num_rows_callback(MenuLayer *menu_layer, uint16_t section_index, void *data) {
+  return s_gallery->count + 1;
+}
+
+// Set menu item heights (drawing items are tall enough for the thumbnail)
+static int16_t menu_get_cell_height_callback(MenuLayer *menu_layer, MenuIndex *cell_index, void *data) {
+  return (cell_index->row == MENU_NEW_ITEM) ? NEW_CELL_HEIGHT : THUMB_CELL_HEIGHT;
+}
+
+// Load the thumbnail of a drawing into the thumbnail bitmap
+static bool load_thumb(uint8_t index) {
+  if (s_thumb_bitmap == NULL || s_thumb_event == NULL || !s_thumb_event(index, s_thumb)) return false;
+  
+  // Bitmap rows are padded to whole words
+  uint8_t *addr = s_thumb_bitmap->addr;
+  for (int y = 0; y < THUMB_HEIGHT; y++) {
+    memcpy(addr + (y * s_thumb_bitmap->row_size_bytes), s_thumb + (y * THUMB_ROW_BYTES), THUMB_ROW_BYTES);
+  }
+  return true;
+}
+
+// Draw menu items
+static void menu_draw_row_callback(GContext* ctx, const Layer *cell_layer, MenuIndex *cell_index, void *data) {
+  char title_str[12];
+  
+  if (cell_index->row == MENU_NEW_ITEM) {
+    // Option for starting a new drawing
+    menu_cell_basic_draw(ctx, cell_layer, "New Drawing", 
+                         (s_gallery->count >= MAX_DRAWINGS) ? "Gallery full" : NULL, NULL);
+  } else {
+    // Show drawing thumbnail, with the drawing being edited marked
+    uint8_t index = cell_index->row - 1;
+    snprintf(title_str, sizeof(title_str), "Drawing %d", s_gallery->count - index);
+    menu_cell_basic_draw(ctx, cell_layer, title_str, 
+                         (index == s_delete_index) ? "Hold to delete" : (index == s_gallery->current) ? "Editing" : NULL, 
+                         load_thumb(index) ? s_thumb_bitmap : NULL);
+  }
+}
+
+// Process menu item select clicks
+static void menu_select_callback(MenuLayer *menu_layer, MenuIndex *cell_index, void *data) {
+  if (s_delete_index != NO_DRAWING) {
+    // Cancel deleting instead of opening the drawing
+    s_delete_index = NO_DRAWING;
+    menu_layer_reload_data(gallery_layer);
+    return;
+  }
+  
+  // Call event in main unit to switch to the drawing (or start a new one)
+  int8_t index = (cell_index->row == MENU_NEW_ITEM) ? -1 : cell_index->row - 1;
+  
+  // Can't start a new drawing if there is no room to save it
+  if (index < 0 && s_gallery->count >= MAX_DRAWINGS) return;
+  
+  if (s_open_event != NULL && !s_open_event(index)) {
+    // Stay in the gallery if the current drawing couldn't be saved (so drawings can be deleted to
+    // make room for it). Saving it may still have added it to the gallery
+    menu_layer_reload_data(gallery_layer);
+    return;
+  }
+  hide_gallery();
+}
+
+// Process menu item long clicks (deletes the drawing). The first long click asks for another one
+// to confirm, so a drawing can't be deleted by accident
+static void menu_select_long_callback(MenuLayer *menu_layer, MenuIndex *cell_index, void *data) {
+  if (cell_index->row == MENU_NEW_ITEM) return;
+  
+  int index = cell_index->row - 1;
+  if (index == s_delete_index) {
+    s_delete_index = NO_DRAWING;
+    if (s_delete_event != NULL) s_delete_event(index);
+    vibes_short_pulse();
+  } else {
+    s_delete_index = index;
+  }
+  menu_layer_reload_data(gallery_layer);
+}
+
+// Cancel deleting when moving to another menu item
+static void menu_selection_changed_callback(MenuLayer *menu_layer, MenuIndex new_index, MenuIndex old_index, void *data) {
+  if (s_delete_index != NO_DRAWING) {
+    s_delete_index = NO_DRAWING;
+    layer_mark_dirty(menu_layer_get_layer(gallery_layer));
+  }
+}
+
+static void handle_window_unload(Window* window) {
+  destroy_ui();
+}
+
+// Show gallery window with the gallery index passed as reference to structure and with callback procedures
+void show_gallery(struct Gallery_st *gallery, GalleryOpenCallBack open_event, GalleryDeleteCallBack delete_event, GalleryThumbCallBack thumb_event) {
+  initialise_ui();
+  window_set_window_handlers(s_window, (WindowHandlers) {
+    .unload = handle_window_unload,
+  });
+  
+  s_gallery = gallery;
+  s_open_event = open_event;
+  s_delete_event = delete_event;
+  s_thumb_event = thumb_event;
+  s_delete_index = NO_DRAWING;
+  
+  // Set all the callbacks for the menu layer
+  menu_layer_set_callbacks(gallery_layer, NULL, (MenuLayerCallbacks){
+    .get_num_sections = menu_get_num_sections_callback,
+    .get_num_rows = menu_get_num_rows_callback,
+    .get_cell_height = menu_get_cell_height_callback,
+    .draw_row = menu_draw_row_callback,
+    .select_click = menu_select_callback,
+    .select_long_click = menu_select_long_callback,
+    .selection_changed = menu_selection_changed_callback
+  });
+  
+  window_stack_push(s_window, true);
+}
+
+void hide_gallery(void) {
+  window_stack_remove(s_window, true);
+}
@@ -0,0 +1,18 @@
+#pragma once
+#include <pebble.h>
+
+#define MAX_DRAWINGS 6
+  
+typedef bool (*GalleryOpenCallBack)(int8_t index);
+typedef void (*GalleryDeleteCallBack)(uint8_t index);
+typedef bool (*GalleryThumbCallBack)(uint8_t index, uint8_t *thumb);
+
+// Index of saved drawings (stored as is in the watch storage)
+struct Gallery_st {
+  uint8_t count;                // Number of saved drawings
+  int8_t current;               // Index of the drawing being edited (-1 if not saved yet)
+  uint8_t slots[MAX_DRAWINGS];  // Storage slot of each drawing, newest first
+};
+
+void show_gallery(struct Gallery_st *gallery, GalleryOpenCallBack open_event, GalleryDeleteCallBack delete_event, GalleryThumbCallBack thumb_event);
+void hide_gallery(void);
@@ -0,0 +1,102 @@
+#include <pebble.h>
+#include "heap.h"
+#include "common.h"
+
+// Keeps count of the heap used by the app's bitmaps, windows and buffers (the live total and the
+// most it has reached), and warns in the log when an allocation is about to fail for lack of heap
+// rather than leaving a NULL check to quietly skip the feature
+
+#define WINDOW_BYTES 120   // Approximate heap used by a window and its root layer
+#define HEAP_OVERHEAD 8    // Allocator bookkeeping per allocation
+
+static size_t s_live_bytes = 0;
+static size_t s_peak_bytes = 0;
+
+// Heap used by a blank bitmap (rows are padded to 32 bits)
+static size_t bitmap_bytes(GSize size) {
+  return sizeof(GBitmap) + (((size.w + 31) / 32) * 4 * size.h) + (2 * HEAP_OVERHEAD);
+}
+
+// Warn if there isn't enough heap left for an allocation
+static void check_free(size_t bytes) {
+  size_t free_bytes = heap_bytes_free();
+  if (free_bytes < bytes + HEAP_OVERHEAD)
+    APP_LOG(APP_LOG_LEVEL_WARNING, "Not enough heap for %d bytes - %d free, %d in use (peak %d)", 
+            (int)bytes, (int)free_bytes, (int)s_live_bytes, (int)s_peak_bytes);
+}
+
+static void add_live(size_t bytes) {
+  s_live_bytes += bytes;
+  if (s_live_bytes > s_peak_bytes) s_peak_bytes = s_live_bytes;
+}
+
+static void remove_live(size_t bytes) {
+  s_live_bytes = (bytes < s_live_bytes) ? s_live_bytes - bytes : 0;
+}
+
+GBitmap *heap_bitmap_create(GSize size) {
+  size_t bytes = bitmap_bytes(size);
+  check_free(bytes);
+  
+  GBitmap *bitmap = gbitmap_create_blank(size);
+  if (bitmap != NULL)
+    add_live(bytes);
+  else
+    APP_LOG(APP_LOG_LEVEL_ERROR, "Failed to create %dx%d bitmap - %d bytes free", size.w, size.h, (int)heap_bytes_free());
+  return bitmap;
+}
+
+void heap_bitmap_destroy(GBitmap *bitmap) {
+  if (bitmap == NULL) return;
+  remove_live(bitmap_bytes(bitmap->bounds.size));
+  gbitmap_destroy(bitmap);
+}
+
+Window *heap_window_create(void) {
+  check_free(WINDOW_BYTES);
+  
+  Window *window = window_create();
+  if (window != NULL)
+    add_live(WINDOW_BYTES);
+  else
+    APP_LOG(APP_LOG_LEVEL_ERROR, "Failed to create window - %d bytes free", (int)heap_bytes_free());
+  return window;
+}
+
+void heap_window_destroy(Window *window) {
+  if (window == NULL) return;
+  remove_live(WINDOW_BYTES);
+  window_destroy(window);
+}
+
+void *heap_malloc(size_t size) {
+  check_free(size);
+  
+  void *ptr = malloc(size);
+  if (ptr != NULL)
+    add_live(size + HEAP_OVERHEAD);
+  else
+    APP_LOG(APP_LOG_LEVEL_ERROR, "Failed to allocate %d bytes - %d bytes free", (int)size, (int)heap_bytes_free());
+  return ptr;
+}
+
+// Free memory from heap_malloc (the size must be the one it was allocated with)
+void heap_free(void *ptr, size_t size) {
+  if (ptr == NULL) return;
+  remove_live(size + HEAP_OVERHEAD);
+  free(ptr);
+}
+
+size_t heap_live_bytes(void) {
+  return s_live_bytes;
+}
+
+size_t heap_peak_bytes(void) {
+  return s_peak_bytes;
+}
+
+// Log the heap use after an event (e.g. an undo or save)
+void heap_log(const char *event) {
+  APP_LOG(APP_LOG_LEVEL_DEBUG, "Heap after %s - In use: %d, Peak: %d, Free: %d", 
+          event, (int)s_live_bytes, (int)s_peak_bytes, (int)heap_bytes_free());
+}
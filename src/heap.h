@@ -0,0 +1,12 @@
+#pragma once
+#include <pebble.h>
+
+GBitmap *heap_bitmap_create(GSize size);
+void heap_bitmap_destroy(GBitmap *bitmap);
+Window *heap_window_create(void);
+void heap_window_destroy(Window *window);
+void *heap_malloc(size_t size);
+void heap_free(void *ptr, size_t size);
+size_t heap_live_bytes(void);
+size_t heap_peak_bytes(void);
+void heap_log(const char *event);
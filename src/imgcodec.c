@@ -0,0 +1,218 @@
+#include <pebble.h>
+#include "imgcodec.h"
+
+// Compression for 1-bit image rows. Each row is either a repeat of the row above, or is
+// PackBits run-length encoded, which suits line art where most bytes are white (0xFF).
+// Tokens:
+//  0x00 - 0x7F: the next (token + 1) bytes are copied as is
+//  0x80:        the row is the same as the previous row (only at the start of a row)
+//  0x81 - 0xFF: the next byte is repeated (257 - token) times
+// Rows are encoded/decoded one at a time, so a whole image never needs a second buffer
+
+#define TOKEN_REPEAT_ROW 0x80
+#define MAX_LITERAL 128
+#define MAX_RUN 128
+#define MIN_RUN 3
+
+#define ADLER_MOD 65521
+#define ADLER_NMAX 5552  // Bytes that can be summed before the sums could overflow
+
+#define FNV_OFFSET 2166136261u
+#define FNV_PRIME 16777619u
+
+#define THUMB_SCALE 4
+#define THUMB_BLACK_PIXELS 3  // Black pixels in a 4x4 block that make a black thumbnail pixel
+
+// Encode a row of any width (comparing with the previous row if given), returning the encoded
+// length (at most row_bytes + 1)
+static uint8_t encode_row(const uint8_t *row, const uint8_t *prev_row, uint8_t row_bytes, uint8_t *dest) {
+  if (prev_row != NULL && memcmp(row, prev_row, row_bytes) == 0) {
+    dest[0] = TOKEN_REPEAT_ROW;
+    return 1;
+  }
+  
+  uint8_t len = 0;
+  uint8_t literal_start = 0;  // Position of the current literal token in dest
+  uint8_t literal_count = 0;
+  int i = 0;
+  
+  while (i < row_bytes) {
+    // Measure the run of identical bytes
+    int run = 1;
+    while (i + run < row_bytes && run < MAX_RUN && row[i + run] == row[i]) run++;
+    
+    if (run >= MIN_RUN) {
+      // Runs are stored as a repeat (ending any literal). Shorter runs stay in the literal so
+      // splitting a literal never makes the row longer than row_bytes + 1
+      dest[len++] = 257 - run;
+      dest[len++] = row[i];
+      literal_count = 0;
+      i += run;
+    } else {
+      // Add byte to the current literal (starting a new one if needed)
+      if (literal_count == 0 || literal_count == MAX_LITERAL) {
+        literal_start = len++;
+        literal_count = 0;
+      }
+      dest[len++] = row[i++];
+      literal_count++;
+      dest[literal_start] = literal_count - 1;
+    }
+  }
+  
+  return len;
+}
+
+// Decode a row of any width, returning the number of encoded bytes used (0 if the data is invalid)
+static uint16_t decode_row(const uint8_t *src, uint16_t len, const uint8_t *prev_row, uint8_t row_bytes, uint8_t *row) {
+  uint16_t p = 0;
+  int i = 0;
+  
+  if (len > 0 && src[0] == TOKEN_REPEAT_ROW) {
+    if (prev_row == NULL) return 0;
+    memcpy(row, prev_row, row_bytes);
+    return 1;
+  }
+  
+  while (i < row_bytes) {
+    if (p >= len) return 0;
+    uint8_t token = src[p++];
+    
+    if (token < TOKEN_REPEAT_ROW) {
+      int count = token + 1;
+      if (i + count > row_bytes || p + count > len) return 0;
+      memcpy(row + i, src + p, count);
+      p += count;
+      i += count;
+    } else if (token > TOKEN_REPEAT_ROW) {
+      int count = 257 - token;
+      if (i + count > row_bytes || p >= len) return 0;
+      memset(row + i, src[p++], count);
+      i += count;
+    } else {
+      return 0;
+    }
+  }
+  
+  return p;
+}
+
+// Encode a number of consecutive rows of any width, returning the encoded length
+static uint16_t encode_rows(const uint8_t *rows, uint16_t row_count, uint8_t row_bytes, uint8_t *dest) {
+  uint16_t len = 0;
+  
+  for (uint16_t r = 0; r < row_count; r++) {
+    const uint8_t *row = rows + (r * row_bytes);
+    len += encode_row(row, (r > 0) ? (row - row_bytes) : NULL, row_bytes, dest + len);
+  }
+  
+  return len;
+}
+
+// Decode a number of consecutive rows of any width, returning false if the data is invalid
+static bool decode_rows(const uint8_t *src, uint16_t len, uint8_t *rows, uint16_t row_count, uint8_t row_bytes) {
+  uint16_t p = 0;
+  
+  for (uint16_t r = 0; r < row_count; r++) {
+    uint8_t *row = rows + (r * row_bytes);
+    uint16_t used = decode_row(src + p, len - p, (r > 0) ? (row - row_bytes) : NULL, row_bytes, row);
+    if (used == 0) return false;
+    p += used;
+  }
+  
+  return true;
+}
+
+// Encode an image row, returning the encoded length (at most IMG_ROW_MAX_ENCODED bytes)
+uint8_t imgcodec_encode_row(const uint8_t *row, const uint8_t *prev_row, uint8_t *dest) {
+  return encode_row(row, prev_row, IMG_ROW_BYTES, dest);
+}
+
+// Decode an image row, returning the number of encoded bytes used (0 if the data is invalid)
+uint16_t imgcodec_decode_row(const uint8_t *src, uint16_t len, const uint8_t *prev_row, uint8_t *row) {
+  return decode_row(src, len, prev_row, IMG_ROW_BYTES, row);
+}
+
+// Encode a number of consecutive image rows, returning the encoded length
+// (dest must have room for row_count * IMG_ROW_MAX_ENCODED bytes)
+uint16_t imgcodec_encode_rows(const uint8_t *rows, uint16_t row_count, uint8_t *dest) {
+  return encode_rows(rows, row_count, IMG_ROW_BYTES, dest);
+}
+
+// Decode a number of consecutive image rows, returning false if the data is invalid
+bool imgcodec_decode_rows(const uint8_t *src, uint16_t len, uint8_t *rows, uint16_t row_count) {
+  return decode_rows(src, len, rows, row_count, IMG_ROW_BYTES);
+}
+
+// Encode a thumbnail, returning the encoded length (at most THUMB_MAX_ENCODED bytes)
+uint16_t imgcodec_encode_thumb(const uint8_t *thumb, uint8_t *dest) {
+  return encode_rows(thumb, THUMB_HEIGHT, THUMB_ROW_BYTES, dest);
+}
+
+// Decode a thumbnail, returning false if the data is invalid
+bool imgcodec_decode_thumb(const uint8_t *src, uint16_t len, uint8_t *thumb) {
+  return decode_rows(src, len, thumb, THUMB_HEIGHT, THUMB_ROW_BYTES);
+}
+
+// Create a quarter size thumbnail of the image. Each thumbnail pixel covers a 4x4 block of image
+// pixels and is black if a few of them are (so 1 pixel lines still show). The black pixels of
+// each block are counted 8 blocks at a time by popcounting each nibble of a row word in parallel
+void imgcodec_make_thumb(const uint8_t *image, uint8_t *thumb) {
+  for (int ty = 0; ty < THUMB_HEIGHT; ty++) {
+    const uint32_t *words = (const uint32_t *)(image + (ty * THUMB_SCALE * IMG_ROW_BYTES));
+    uint8_t *trow = thumb + (ty * THUMB_ROW_BYTES);
+    memset(trow, 0, THUMB_ROW_BYTES);
+    
+    for (int w = 0; w < IMG_ROW_BYTES / 4; w++) {
+      // Black pixel counts of the even and odd nibbles, one per byte
+      uint32_t even = 0;
+      uint32_t odd = 0;
+      
+      for (int r = 0; r < THUMB_SCALE; r++) {
+        uint32_t v = ~words[(r * IMG_ROW_BYTES / 4) + w];
+        v = v - ((v >> 1) & 0x55555555);
+        v = (v & 0x33333333) + ((v >> 2) & 0x33333333);
+        even += v & 0x0F0F0F0F;
+        odd += (v >> 4) & 0x0F0F0F0F;
+      }
+      
+      for (int n = 0; n < 8; n++) {
+        int tx = (w * 8) + n;
+        if (tx >= THUMB_WIDTH) break;
+        uint32_t count = (((n & 1) ? odd : even) >> ((n / 2) * 8)) & 0xFF;
+        if (count < THUMB_BLACK_PIXELS) trow[tx / 8] |= 1 << (tx % 8);
+      }
+    }
+  }
+}
+
+// Adler-32 checksum, for checking image data read back from storage
+uint32_t imgcodec_checksum(const uint8_t *data, uint16_t len) {
+  uint32_t a = 1;
+  uint32_t b = 0;
+  
+  while (len > 0) {
+    uint16_t n = (len < ADLER_NMAX) ? len : ADLER_NMAX;
+    len -= n;
+    while (n-- > 0) {
+      a += *data++;
+      b += a;
+    }
+    a %= ADLER_MOD;
+    b %= ADLER_MOD;
+  }
+  
+  return (b << 16) | a;
+}
+
+// FNV-1a hash of an image row, for spotting rows that have changed
+uint32_t imgcodec_row_hash(const uint8_t *row) {
+  uint32_t hash = FNV_OFFSET;
+  
+  for (int i = 0; i < IMG_ROW_BYTES; i++) {
+    hash ^= row[i];
+    hash *= FNV_PRIME;
+  }
+  
+  return hash;
+}
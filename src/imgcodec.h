@@ -0,0 +1,27 @@
+#pragma once
+#include <pebble.h>
+#include "common.h"
+
+// Image is compressed in blocks of rows, each small enough to fit one storage entry
+#define IMG_BLOCK_ROWS 12
+#define IMG_BLOCK_BYTES (IMG_BLOCK_ROWS * IMG_ROW_BYTES)
+#define IMG_BLOCKS (IMG_HEIGHT / IMG_BLOCK_ROWS)
+#define IMG_ROW_MAX_ENCODED (IMG_ROW_BYTES + 1)
+#define IMG_BLOCK_MAX_ENCODED (IMG_BLOCK_ROWS * IMG_ROW_MAX_ENCODED)
+
+// Quarter size thumbnail, in the same 1-bit format as the image
+#define THUMB_WIDTH (IMG_WIDTH / 4)
+#define THUMB_HEIGHT (IMG_HEIGHT / 4)
+#define THUMB_ROW_BYTES ((THUMB_WIDTH + 7) / 8)
+#define THUMB_BYTES (THUMB_ROW_BYTES * THUMB_HEIGHT)
+#define THUMB_MAX_ENCODED (THUMB_HEIGHT * (THUMB_ROW_BYTES + 1))
+
+uint8_t imgcodec_encode_row(const uint8_t *row, const uint8_t *prev_row, uint8_t *dest);
+uint16_t imgcodec_decode_row(const uint8_t *src, uint16_t len, const uint8_t *prev_row, uint8_t *row);
+uint16_t imgcodec_encode_rows(const uint8_t *rows, uint16_t row_count, uint8_t *dest);
+bool imgcodec_decode_rows(const uint8_t *src, uint16_t len, uint8_t *rows, uint16_t row_count);
+uint16_t imgcodec_encode_thumb(const uint8_t *thumb, uint8_t *dest);
+bool imgcodec_decode_thumb(const uint8_t *src, uint16_t len, uint8_t *thumb);
+void imgcodec_make_thumb(const uint8_t *image, uint8_t *thumb);
+uint32_t imgcodec_checksum(const uint8_t *data, uint16_t len);
+uint32_t imgcodec_row_hash(const uint8_t *row);
@@ -1,5 +1,6 @@
 #include "infowin.h"
 #include <pebble.h>
+#include "heap.h"
 
 // Simple window with info on what each button does on the main window and how to clear the image
   
@@ -19,7 +20,7 @@ static TextLayer *s_textlayer_10;
 static TextLayer *s_textlayer_6;
 
 static void initialise_ui(void) {
-  s_window = window_create();
+  s_window = heap_window_create();
   window_set_fullscreen(s_window, true);
   
   // s_textlayer_1
@@ -91,7 +92,7 @@ static void initialise_ui(void) {
 }
 
 static void destroy_ui(void) {
-  window_destroy(s_window);
+  heap_window_destroy(s_window);
   text_layer_destroy(s_textlayer_1);
   text_layer_destroy(s_textlayer_2);
   text_layer_destroy(s_textlayer_3);
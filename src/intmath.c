@@ -1,7 +1,18 @@
 #include <pebble.h>
 #include "intmath.h"
 
-// Integer math procedures
+// Integer and fixed-point math procedures
+// Accuracy (checked against libm over the full accelerometer range and a sample of the rest of the
+// 32 bit range by the accuracy cases in host/bench.c):
+//  intsqrt  - exact (rounded to nearest), as is intsqrt_floor (rounded down)
+//  intrsqrt - within 1 unit of the Q16 result
+//  intatan2 - within 2 angle units (0.011 degrees)
+
+// Number of leading zero bits (input must not be 0). Compiles to a single CLZ instruction on the watch
+static inline uint32_t leading_zeros(uint32_t input)
+{
+    return __builtin_clz(input);
+}
 
 // Integer division with rounding
 int32_t divide(int32_t n, int32_t d)
@@ -16,10 +27,9 @@ uint32_t intsqrt(uint32_t input)
   
     uint32_t op  = input;
     uint32_t result = 0;
-    uint32_t one = 1uL << 30; 
 
-    // Find the highest power of four <= than the input.
-    while (one > op) one >>= 2;
+    // Start at the highest power of four <= than the input (found from the leading zeros)
+    uint32_t one = 1uL << ((31 - leading_zeros(input)) & ~1uL);
   
     // Find the root
     while (one != 0)
@@ -37,4 +47,115 @@ uint32_t intsqrt(uint32_t input)
     if (op > result) result++;
 
     return result;
-}
\ No newline at end of file
+}
+
+// Integer square-root rounded down (largest value whose square does not exceed the input)
+uint32_t intsqrt_floor(uint32_t input)
+{
+    uint32_t result = intsqrt(input);
+    // (Inputs above 65535.5^2 round up to 65536, whose square doesn't fit in 32 bits)
+    if (result > UINT16_MAX || result * result > input) result--;
+    return result;
+}
+
+// Reciprocal square-root (1 / sqrt(input)) as a Q16 fixed-point value
+uint32_t intrsqrt(uint32_t input)
+{
+    if (input == 0) return UINT32_MAX;
+  
+    // Shift the input up by an even number of bits so the root has 16 bits of precision,
+    // then shift the reciprocal back by half as many bits
+    uint32_t shift = leading_zeros(input) & ~1uL;
+    uint32_t root = intsqrt(input << shift);
+    uint32_t one = 1uL << (16 + (shift / 2));
+  
+    return (one + (root / 2)) / root;
+}
+
+// Limit a value to a range
+int32_t clamp32(int32_t value, int32_t min, int32_t max)
+{
+  return (value < min) ? min : ((value > max) ? max : value);
+}
+
+// Addition that saturates instead of overflowing
+int32_t sat_add32(int32_t a, int32_t b)
+{
+  int64_t sum = (int64_t)a + b;
+  return (int32_t)((sum > INT32_MAX) ? INT32_MAX : ((sum < INT32_MIN) ? INT32_MIN : sum));
+}
+
+// Q16 fixed-point multiply (rounded) that saturates instead of overflowing
+int32_t q16_mul(int32_t a, int32_t b)
+{
+  int64_t product = (((int64_t)a * b) + (1 << 15)) >> 16;
+  return (int32_t)((product > INT32_MAX) ? INT32_MAX : ((product < INT32_MIN) ? INT32_MIN : product));
+}
+
+// atan(i/32) for i = 0 to 32, in angle units (0 to 2^16 representing 0 to 360 degrees)
+static const uint16_t s_atan_table[33] = {
+  0, 326, 651, 975, 1297, 1617, 1933, 2246, 2555, 2860, 3159, 3453, 3742, 4025, 4302, 4572, 
+  4836, 5094, 5344, 5589, 5826, 6058, 6282, 6500, 6712, 6917, 7117, 7310, 7498, 7679, 7856, 8026, 8192
+};
+
+// Angle of the point (x, y) from the x axis (0 to 2^16 representing 0 to 360 degrees).
+// Uses an interpolated table for the first octant and symmetry for the rest
+uint16_t intatan2(int32_t y, int32_t x)
+{
+  if (x == 0 && y == 0) return 0;
+  
+  uint32_t ax = (x < 0) ? -x : x;
+  uint32_t ay = (y < 0) ? -y : y;
+  bool swapped = ay > ax;
+  uint32_t lo = swapped ? ax : ay;
+  uint32_t hi = swapped ? ay : ax;
+  
+  // Ratio (0 to 1) in Q15, split into table index and 10 bit fraction for interpolating
+  uint32_t ratio = (uint32_t)(((uint64_t)lo << 15) / hi);
+  uint32_t index = ratio >> 10;
+  uint32_t frac = ratio & 0x3FF;
+  int32_t angle = s_atan_table[index];
+  if (index < 32)
+    angle += (((s_atan_table[index + 1] - s_atan_table[index]) * frac) + 0x200) >> 10;
+  
+  // Map the first octant angle to the actual octant
+  if (swapped) angle = 0x4000 - angle;
+  if (x < 0) angle = 0x8000 - angle;
+  if (y < 0) angle = 0x10000 - angle;
+  
+  return (uint16_t)angle;
+}
+
+// Convert accelerometer values to the watch's tilt angles in the x and y plane
+// (Angle values are 0 to 2^16 representing 0 to 360 degrees linearly)
+void tilt_to_angles(int32_t x, int32_t y, int32_t z, uint16_t *angle_x, uint16_t *angle_y)
+{
+  int32_t z_sign = (z > 0) ? -1 : 1;
+  
+  *angle_x = intatan2(x * z_sign, intsqrt((y * y) + (z * z)));
+  *angle_y = intatan2(y, (int32_t)intsqrt((x * x) + (z * z)) * z_sign);
+}
+
+// Map one tilt angle to a cursor position across a range (0 to range, center at range/2)
+static int16_t tilt_to_position(uint16_t angle, uint16_t center, int16_t max_tilt, int16_t range)
+{
+  // Use overflow of uint16 math into a int16 to correctly calculate diffs for cursor position.
+  // (Angle values are 0 to UINT16_MAX representing 0 to 360 degrees, so 180 to 360 will overflow
+  //  causing rotation to reverse, but that is correct as the watch will be upside down)
+  int16_t diff = angle - center;
+  
+  diff = clamp32(diff, -max_tilt, max_tilt);
+  return (range / 2) + divide(diff * (range / 2), max_tilt);
+}
+
+// Convert accelerometer values to a cursor location, based on the tilt from the center angles.
+// Tilting by max_tilt in any direction moves the cursor to the edge of the area
+GPoint tilt_to_cursor(int32_t x, int32_t y, int32_t z, uint16_t center_x, uint16_t center_y, int16_t max_tilt, GSize size)
+{
+  uint16_t angle_x, angle_y;
+  
+  tilt_to_angles(x, y, z, &angle_x, &angle_y);
+  
+  return GPoint(tilt_to_position(angle_x, center_x, max_tilt, size.w),
+                tilt_to_position(angle_y, center_y, max_tilt, size.h));
+}
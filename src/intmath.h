@@ -1,4 +1,18 @@
 #pragma once
+#include <pebble.h>
+
+#define Q16_ONE 65536
 
 int32_t divide(int32_t n, int32_t d);
-uint32_t intsqrt(uint32_t input);
\ No newline at end of file
+uint32_t intsqrt(uint32_t input);
+uint32_t intsqrt_floor(uint32_t input);
+uint32_t intrsqrt(uint32_t input);
+
+int32_t clamp32(int32_t value, int32_t min, int32_t max);
+int32_t sat_add32(int32_t a, int32_t b);
+int32_t q16_mul(int32_t a, int32_t b);
+
+uint16_t intatan2(int32_t y, int32_t x);
+
+void tilt_to_angles(int32_t x, int32_t y, int32_t z, uint16_t *angle_x, uint16_t *angle_y);
+GPoint tilt_to_cursor(int32_t x, int32_t y, int32_t z, uint16_t center_x, uint16_t center_y, int16_t max_tilt, GSize size);
@@ -5,17 +5,32 @@
 #include "infowin.h"
 #include "settings.h"
 #include "msg.h"
+#include "filter.h"
+#include "tracking.h"
+#include "imgcodec.h"
+#include "gallery.h"
+#include "stream.h"
+#include "trace.h"
+#include "profile.h"
+#include "heap.h"
 
 // Main app unit - controls application and processes acceleromoter events
   
-#define HIGH_TILT UINT16_MAX / 14   // Approx. 25deg
-#define MEDIUM_TILT UINT16_MAX / 10 // Approx. 35deg
-#define LOW_TILT UINT16_MAX / 8     // 45deg
-  
-#define FILTER_K 0.9  // Accelerometer smoothing constant (Must be less than 1. Higher = smoother, slower. Lower = faster, less smooth)
+#define SEND_PROGRESS_STEP 25   // Only update the sending progress message every 25%
+#define MAX_SEND_RETRIES 5      // Times a chunk is resent before waiting for the phone to reconnect
+#define SEND_RETRY_DELAY 250    // Delay before the first resend in ms (doubled for each retry)
+#define STREAM_PERIOD 300       // Time between batches of strokes sent for live sync in ms
+#define STROKE_BATCH_SIZE 128   // Most stroke bytes sent in one message
+
+#define AUTOSAVE_PERIOD 30000  // Time between background saves of the image in ms
+#define LOAD_BLOCKS_PER_STEP 2  // Image blocks loaded per startup step (so the canvas can update between)
+#define STARTUP_STEP_DELAY 5    // Time between startup steps in ms
 
-#define IMAGE_CHUNK_SIZE 512
-#define PERSIST_SIZE_MAX 256
+// Storage keys of each drawing, relative to its first key
+#define DRAWING_KEY_SPAN 32     // Keys reserved for each drawing
+#define BANK_KEY_OFFSET 16      // Second copy of each image block (first copy is at 0)
+#define THUMB_KEY_OFFSET 15     // Thumbnail
+#define HEADER_KEY_OFFSET 30    // Image headers, alternating between 2 keys by generation
   
 // App settings index keys
 enum SettingKeys {
@@ -25,39 +40,114 @@ enum SettingKeys {
   SECONDSHAKE_CLEAR_KEY = 4,
   ERASERSIZE_KEY = 5,
   PENWIDTH_KEY = 6,
+  ERASERSHAPE_KEY = 7,
+  SMOOTHING_KEY = 8,
+  EVERYSAMPLE_KEY = 9,
+  IMAGEFORMAT_KEY = 10,
+  GALLERY_KEY = 11,
+  INFOSHOWN_KEY = 12,
+  LIVESYNC_KEY = 13,
   IMAGEDATA_START_KEY = 20
 };
 
+// Image storage formats (no format key means raw 256 byte chunks)
+enum ImageFormats {
+  IMAGE_FORMAT_RAW = 0,
+  IMAGE_FORMAT_RLE = 1,
+  IMAGE_FORMAT_ROWS = 2   // Compressed row ranges (only sent to the phone)
+};
+
 // App message keys
 enum AppMsgKeys {
   IMAGE_DATA_SEND_KEY = 1,
-  CHUNK_STATUS_KEY = 2
+  CHUNK_STATUS_KEY = 2,
+  IMAGE_FORMAT_SEND_KEY = 3,
+  CHUNK_OFFSET_KEY = 4,
+  IMAGE_LENGTH_KEY = 5,
+  BASE_CHECKSUM_KEY = 6,
+  RESYNC_KEY = 7,
+  STROKE_DATA_KEY = 8
 };
 
 // Image data chunk sending statuses
 enum ChunkStatuses {
   FIRST_CHUNK = 1,
   MID_CHUNK = 2,
-  LAST_CHUNK = 3
+  LAST_CHUNK = 3,
+  ONLY_CHUNK = 4
 };
 
-// Variables for cursor centering
-static bool s_centered = false;
-static uint16_t s_center_x;
-static uint16_t s_center_y;
+// Buffers for one compressed image block and a thumbnail (kept off the stack)
+static uint8_t s_block_buf[IMG_BLOCK_MAX_ENCODED];
+static uint8_t s_thumb_buf[THUMB_BYTES];
+
+// Index of the drawings saved on the watch
+static struct Gallery_st s_gallery;
 
-// Variables for filtered (smoothed) acceleromter values
-static int s_filtered_x;
-static int s_filtered_y;
-static int s_filtered_z;
+// Header saved after each image save, pointing to the copy of each block with the latest data.
+// Each save only writes to the block copies the current header doesn't use, so an interrupted
+// save leaves the previous image intact.
+typedef struct {
+  uint32_t generation;  // Incremented every save
+  uint32_t checksum;    // Checksum of all the image data
+  uint16_t bank_mask;   // Bit set for each block whose latest data is in the second bank
+} ImageHeader;
+
+static ImageHeader s_image_header;  // Header of the drawing being edited
+static bool s_save_failed = false;  // Set while saves are failing (so autosave only reports it once)
+static char *s_save_error;          // Why the last failed save failed
+
+// State of the image being loaded (loading is spread over several steps)
+static uint32_t s_load_key;             // First storage key of the drawing
+static ImageHeader s_load_headers[2];   // Saves to try loading, latest first
+static uint8_t s_load_count;            // Number of saves to try (0 when loaded)
+static uint8_t s_load_try;              // Save being loaded
+static uint8_t s_load_block;            // Next block to load
+static bool s_load_ok;                  // Set while all blocks have loaded
+static bool s_load_verify;              // Set if the image checksum should be checked
+static bool s_load_damaged;             // Set if no save checks out and the image must be rewritten
+
+static uint32_t s_startup_time;  // When the app started, for startup timing
 
-static int s_max_tilt;
-static bool s_changed = false; // Indicates if the image has changed
 static bool s_infocus = true;  // Indicates if the app is in focus
+static bool s_shake_undid = false;  // Set if the last shake undid a change (and nothing was drawn since)
 static bool s_perm_light_on = false;
 
+// Image sending state. The image is sent compressed, and each chunk has its offset in the
+// compressed data so the phone can put it in place, and sending can resume after a failure
+// from the last chunk the phone acknowledged
 static bool s_sending_image = false;
-static int s_chunk_pos;
+static bool s_send_waiting = false; // Set while waiting for the phone to reconnect
+static uint16_t s_send_row;         // Next image row to compress into a chunk
+static uint16_t s_send_offset;      // Offset of the next chunk in the compressed data
+static uint16_t s_acked_row;        // Row and offset the phone has received up to
+static uint16_t s_acked_offset;
+static uint16_t s_send_length;      // Length of the compressed image
+static uint32_t s_send_checksum;    // Checksum of the image being sent (to detect changes)
+static uint8_t s_send_retries;
+static int s_send_progress;         // Percentage last shown in the sending message
+static uint8_t *s_chunk_buf = NULL;
+static uint16_t s_chunk_size;       // Image bytes that fit in a message
+
+// Only rows changed since the last image the phone received are sent, as ranges of rows each
+// with a 2 byte header (start row, row count) followed by the compressed rows
+#define RANGE_HEADER_SIZE 2
+static uint32_t *s_sent_hashes = NULL;      // Hash of each row the phone has (NULL if unknown)
+static uint32_t s_sent_checksum;            // Checksum of the image the phone has
+static uint8_t s_send_rows[DIRTY_ROW_BYTES]; // Rows being sent (1 bit per row)
+static bool s_send_full;                    // Set if sending every row
+static bool s_send_restart;                 // Set if the phone asked for the whole image
+static bool s_send_quiet;                   // Set if sending to keep up live sync (no messages)
+static AppTimer *s_send_timer = NULL;       // Timer for sending the next chunk (only one at once)
+static bool s_send_pending = false;         // Set if a send waits for a batch of strokes to be sent
+static bool s_send_pending_quiet;
+
+// Live sync sends the strokes drawn in batches between image sends (only 1 message can be sent at once)
+static AppTimer *s_stream_timer = NULL;
+static bool s_stream_sending = false;       // Set while a batch of strokes is being sent
+static uint8_t s_stroke_buf[STROKE_BATCH_SIZE];
+static void start_stream_timer(void);
+static void send_image_chunk(void *data);
 
 static char s_msg[100];
 
@@ -67,99 +157,18 @@ static struct Settings_st s_settings;
 
 // Accelerometer handler, where cursor movement is processed
 static void accel_handler(AccelData *data, uint32_t num_samples) {
+  profile_start(PROFILE_ACCEL);
+  trace_accel(data, num_samples);
   
+  // Only process accelerometer values when app is in focus
   if (s_infocus) {
-    // Only process accelerometer values when app is in focus
-    
-    bool has_valid_sample = true;
-    int total_x = 0;
-    int total_y = 0;
-    int total_z = 0;
-    int avg_x = 0;
-    int avg_y = 0;
-    int avg_z = 0;
-    
-    // Calculate totals in order to average accel in each axis for the sample size
-    for (int i = 0; i < (int)num_samples; i++) {
-      if (data[i].did_vibrate) {
-        has_valid_sample = false;
-        break;
-      }
-      total_x += data[i].x;
-      total_y += -data[i].y;
-      total_z += data[i].z;
-    }
+    GPoint path[ACCEL_BATCH_SIZE];
+    uint8_t count = tracking_process(data, num_samples, path, ACCEL_BATCH_SIZE);
     
-    if (has_valid_sample) {
-      // If there was no vibration, calculate average accel values for sample size
-      avg_x = divide(total_x, num_samples);
-      avg_y = divide(total_y, num_samples);
-      avg_z = divide(total_z, num_samples);
-        
-      if (s_centered) {
-        // If cursor center has been fixed, move cursor as necessary
-        
-        // Average values for sample size are still a little
-        // erratic, so use a single pole, IIR filter to smooth them out
-        s_filtered_x = (s_filtered_x * FILTER_K) + ((1.0 - FILTER_K) * avg_x);
-        s_filtered_y = (s_filtered_y * FILTER_K) + ((1.0 - FILTER_K) * avg_y);
-        s_filtered_z = (s_filtered_z * FILTER_K) + ((1.0 - FILTER_K) * avg_z);
-        
-        // Convert filtered accel values to angles in the x and y plane
-        // (Angle values are 0 to 2^16 representing 0 to 360 degrees linearly)
-        uint16_t adj = intsqrt(s_filtered_y * s_filtered_y + s_filtered_z * s_filtered_z);
-        uint16_t angle_x = atan2_lookup(s_filtered_x * ((s_filtered_z > 0) ? -1 : 1), adj);
-        adj = intsqrt(s_filtered_x * s_filtered_x + s_filtered_z * s_filtered_z) * ((s_filtered_z > 0) ? -1 : 1);
-        uint16_t angle_y = atan2_lookup(s_filtered_y, adj);
-        
-        GPoint loc;
-        
-        // Calculate the difference from the center values to represent cursor movement.
-        // Use overflow of uint16 math into a int16 to correctly calculate diffs for cursor position.
-        // (Angle values are 0 to UINT16_MAX representing 0 to 360 degrees, so 180 to 360 will overflow
-        //  causing rotation to reverse, but that is correct as the watch will be upside down)
-        int16_t diff_x = angle_x - s_center_x;
-  
-        if (diff_x < -s_max_tilt)
-          loc.x = 0;
-        else if (diff_x > s_max_tilt)
-          loc.x = IMG_WIDTH;
-        else
-          loc.x = (IMG_WIDTH/2) + divide(diff_x * (IMG_WIDTH/2), s_max_tilt);
-        
-        int16_t diff_y = angle_y - s_center_y;
-        
-        if (diff_y < -s_max_tilt)
-          loc.y = 0;
-        else if (diff_y > s_max_tilt)
-          loc.y = IMG_HEIGHT;
-        else
-          loc.y = (IMG_HEIGHT/2) + divide(diff_y * (IMG_HEIGHT/2), s_max_tilt);
-        
-        // Move the cursor on the canvas window (The 'pen down' setting will determine if anything is drawn)
-        cursor_set_loc(loc);
-        
-      } else {
-        // Use this sample average as the center location for calculating change for moving the cursor
-        
-        // Convert accel values to angles in the x and y plane
-        uint16_t adj = intsqrt(avg_y * avg_y + avg_z * avg_z);
-        uint16_t angle_x = atan2_lookup(avg_x * ((avg_z > 0) ? -1 : 1), adj);
-        adj = intsqrt(avg_x * avg_x + avg_z * avg_z) * ((avg_z > 0) ? -1 : 1);
-        uint16_t angle_y = atan2_lookup(avg_y, adj);
-        
-        s_center_x = angle_x;
-        s_center_y = angle_y;
-        s_filtered_x = avg_x;
-        s_filtered_y = avg_y;
-        s_filtered_z = avg_z;
-        s_centered = true;
-        
-        APP_LOG(APP_LOG_LEVEL_DEBUG, "Baselines - x: %d g, x: %d deg, y: %d g, y: %d deg, z %d g", 
-                avg_x, (int)divide(360 * angle_x, UINT16_MAX), avg_y, (int)divide(360 * angle_y, UINT16_MAX), avg_z);
-      }
-    }
+    // Move the cursor through the path (the 'pen down' setting will determine if anything is drawn)
+    if (count > 0) cursor_set_path(path, count);
   }
+  profile_end(PROFILE_ACCEL);
 }
 
 static void light_delay(void *data) {
@@ -181,23 +190,35 @@ static void load_settings(void) {
   
   light_control(s_settings.backlight_alwayson && is_pen_down());
   
+  int max_tilt;
   switch (s_settings.sensitivity) {
     case CS_HIGH:
-      s_max_tilt = HIGH_TILT;
+      max_tilt = HIGH_TILT;
       break;
     case CS_LOW:
-      s_max_tilt = LOW_TILT;
+      max_tilt = LOW_TILT;
       break;
     default:
-      s_max_tilt = MEDIUM_TILT;
+      max_tilt = MEDIUM_TILT;
       break;
   }
+  tracking_configure(max_tilt, s_settings.every_sample);
+  trace_config(max_tilt, (s_settings.every_sample ? TRACE_EVERY_SAMPLE : 0) | 
+               (s_settings.adaptive_smoothing ? TRACE_ADAPTIVE : 0) | (s_settings.eraser_round ? TRACE_ERASER_ROUND : 0) |
+               (s_settings.secondshake_clear ? TRACE_SECONDSHAKE_CLEAR : 0) | 
+               (s_settings.drawingcursor_on ? TRACE_DRAWING_CURSOR : 0), s_settings.pen_width, s_settings.eraser_width);
   
   set_penwith(s_settings.pen_width);
   
   set_eraserwidth(s_settings.eraser_width);
   
-  set_undo_undo(!s_settings.secondshake_clear);
+  set_erasershape(s_settings.eraser_round);
+  
+  stream_set_enabled(s_settings.live_sync);
+  
+  // Filter is run on each batch average or on every sample
+  filter_configure(s_settings.adaptive_smoothing ? FILTER_ADAPTIVE : FILTER_FIXED, FILTER_TIME_CONSTANT, 
+                   s_settings.every_sample ? (ACCEL_BATCH_PERIOD / ACCEL_BATCH_SIZE) : ACCEL_BATCH_PERIOD);
 }
 
 // Event fires when settings window is closed
@@ -210,144 +231,814 @@ static void settings_closed(void) {
   persist_write_int(SENSITIVITY_KEY, s_settings.sensitivity);
   persist_write_int(ERASERSIZE_KEY, s_settings.eraser_width);
   persist_write_int(PENWIDTH_KEY, s_settings.pen_width);
+  persist_write_bool(ERASERSHAPE_KEY, s_settings.eraser_round);
+  persist_write_bool(SMOOTHING_KEY, s_settings.adaptive_smoothing);
+  persist_write_bool(EVERYSAMPLE_KEY, s_settings.every_sample);
   persist_write_bool(SECONDSHAKE_CLEAR_KEY, s_settings.secondshake_clear);
+  persist_write_bool(LIVESYNC_KEY, s_settings.live_sync);
+  
+  start_stream_timer();
 }
 
-// Save image pixel data into the watch storage
-static void save_image() {
-  set_paused();
+// First storage key of a drawing's data
+static uint32_t drawing_key(uint8_t slot) {
+  return IMAGEDATA_START_KEY + (slot * DRAWING_KEY_SPAN);
+}
+
+// Save the drawing index into the watch storage
+static void save_gallery(void) {
+  persist_write_data(GALLERY_KEY, &s_gallery, sizeof(s_gallery));
+}
+
+// Find a storage slot not used by any drawing (-1 if all are used)
+static int8_t find_free_slot(void) {
+  for (uint8_t slot = 0; slot < MAX_DRAWINGS; slot++) {
+    bool used = false;
+    for (uint8_t i = 0; i < s_gallery.count; i++) {
+      if (s_gallery.slots[i] == slot) used = true;
+    }
+    if (!used) return slot;
+  }
+  return -1;
+}
+
+// Delete a drawing from the watch storage and the drawing index
+static void delete_drawing(uint8_t index) {
+  uint32_t key = drawing_key(s_gallery.slots[index]);
+  for (int k = 0; k < DRAWING_KEY_SPAN; k++) {
+    if (persist_exists(key + k))
+      persist_delete(key + k);
+  }
+  
+  memmove(&s_gallery.slots[index], &s_gallery.slots[index + 1], s_gallery.count - index - 1);
+  s_gallery.count--;
+  if (s_gallery.current == index)
+    s_gallery.current = -1;
+  else if (s_gallery.current > index)
+    s_gallery.current--;
+  
+  save_gallery();
+}
+
+// Save a thumbnail of the image for showing in the gallery
+static void save_thumb(uint8_t slot, const uint8_t *bytes) {
+  uint32_t tkey = drawing_key(slot) + THUMB_KEY_OFFSET;
+  imgcodec_make_thumb(bytes, s_thumb_buf);
+  uint16_t len = imgcodec_encode_thumb(s_thumb_buf, s_block_buf);
+  if (persist_write_data(tkey, s_block_buf, len) < 0) {
+    // Don't leave an out of date thumbnail (a missing one is remade when the drawing is loaded)
+    APP_LOG(APP_LOG_LEVEL_WARNING, "Failed to write thumbnail");
+    if (persist_exists(tkey)) persist_delete(tkey);
+  }
+}
+
+// Storage key of an image block in the given bank
+static uint32_t block_key(uint32_t key, uint16_t bank_mask, int block) {
+  return key + ((bank_mask & (1 << block)) ? BANK_KEY_OFFSET : 0) + block;
+}
+
+// Write an image block, returning false if the watch storage is full
+static bool write_block(uint32_t bkey, uint16_t len) {
+  // For whatever reason it is faster to always delete and then write the image data
+  if (persist_exists(bkey))
+    persist_delete(bkey);
   
-  if (s_changed) {
+  return persist_write_data(bkey, s_block_buf, len) >= 0;
+}
+
+// Report a failed save (unless quiet), returning false for store_image to return
+static bool save_failed(char *msg, bool quiet) {
+  APP_LOG(APP_LOG_LEVEL_WARNING, "Image not saved: %s", msg);
+  s_save_failed = true;
+  s_save_error = msg;
+  if (!quiet) show_msg(msg, false, 10);
+  return false;
+}
+
+// Write the changed image blocks into the watch storage and then the header pointing to them,
+// returning false if the image couldn't be saved (with a message shown unless quiet)
+static bool store_image(bool quiet) {
+  if (has_dirty_imagedata()) {
     // Save image data
-    void *bytes = get_imagedata();
+    uint8_t *bytes = get_imagedata();
     
-    // For whatever reason it is faster to always delete and then write the image data
-    for (int s = 0; s < ((IMG_PIXELS / PERSIST_SIZE_MAX) + 1); s++) {
-      if (persist_exists(IMAGEDATA_START_KEY + s))
-        persist_delete(IMAGEDATA_START_KEY + s);
+    if (bytes == NULL) {
+      // Image was cleared, so there is nothing to keep
+      if (s_gallery.current >= 0) delete_drawing(s_gallery.current);
+      clear_dirty_imagedata();
+      s_save_failed = false;
+      return true;
     }
     
-    if (bytes != NULL) {
-      // Store the image pixel byte array as chunks in the watch storage
-      // (Each entry can only store up to 256 bytes)
-      for (int s = 0; s < (IMG_PIXELS / PERSIST_SIZE_MAX); s++) {
-        persist_write_data(IMAGEDATA_START_KEY + s, bytes + (s * PERSIST_SIZE_MAX), PERSIST_SIZE_MAX); 
+    if (s_gallery.current < 0) {
+      // First save of a new drawing, so add it to the start of the gallery
+      int8_t slot = find_free_slot();
+      if (slot < 0) 
+        return save_failed("Drawing not saved.\nGallery is full - delete a drawing to save this one", quiet);
+      memmove(&s_gallery.slots[1], &s_gallery.slots[0], s_gallery.count);
+      s_gallery.slots[0] = slot;
+      s_gallery.count++;
+      s_gallery.current = 0;
+      save_gallery();
+      // Nothing is stored in the slot yet
+      memset(&s_image_header, 0, sizeof(s_image_header));
+      mark_imagedata_dirty();
+    }
+    
+    uint8_t slot = s_gallery.slots[s_gallery.current];
+    uint32_t key = drawing_key(slot);
+    ImageHeader header = s_image_header;
+    
+    // Store the changed blocks of rows compressed in the watch storage (each entry can only store
+    // up to 256 bytes), writing to the bank the current header doesn't use
+    for (int b = 0; b < IMG_BLOCKS; b++) {
+      int offset = b * IMG_BLOCK_BYTES;
+      
+      if (is_imagedata_dirty(offset, IMG_BLOCK_BYTES)) {
+        uint16_t len = imgcodec_encode_rows(bytes + offset, IMG_BLOCK_ROWS, s_block_buf);
+        header.bank_mask ^= 1 << b;
+        
+        if (!write_block(block_key(key, header.bank_mask, b), len)) {
+          // Storage is full (each block can take 2 entries), so write over the copy the current
+          // header uses instead. That save can't be fallen back to any more, but loading still
+          // reads what is there and the other blocks of it are untouched
+          APP_LOG(APP_LOG_LEVEL_WARNING, "No room for image block %d - writing it in place", b);
+          header.bank_mask ^= 1 << b;
+          if (!write_block(block_key(key, header.bank_mask, b), len))
+            return save_failed("Drawing not saved.\nWatch storage is full", quiet);
+        }
+      }
+    }
+    
+    // Switch to the new image by writing the header over the header from 2 saves ago
+    header.generation++;
+    header.checksum = imgcodec_checksum(bytes, IMG_PIXELS);
+    if (persist_write_data(key + HEADER_KEY_OFFSET + (header.generation % 2), &header, sizeof(header)) < 0) {
+      // The stored header still points to the previous image, so keep using it and leave the image
+      // dirty (the next save writes the same bank again)
+      return save_failed("Drawing not saved.\nWatch storage is full", quiet);
+    }
+    s_image_header = header;
+    
+    save_thumb(slot, bytes);
+    
+    // Storage format only changes once (from raw chunks to compressed blocks)
+    if (persist_read_int(IMAGEFORMAT_KEY) != IMAGE_FORMAT_RLE)
+      persist_write_int(IMAGEFORMAT_KEY, IMAGE_FORMAT_RLE);
+    
+    clear_dirty_imagedata();
+  }
+  
+  s_save_failed = false;
+  return true;
+}
+
+// Save image pixel data into the watch storage, returning false if it couldn't be saved
+static bool save_image(bool quiet) {
+  profile_start(PROFILE_SAVE);
+  set_paused();
+  bool saved = store_image(quiet);
+  profile_end(PROFILE_SAVE);
+  heap_log("save");
+  return saved;
+}
+
+// Periodically save the image in the background, while not drawing (only showing a message for
+// the first of a run of failed saves)
+static void autosave(void *data) {
+  if (!is_pen_down() && !is_eraser_on())
+    store_image(s_save_failed);
+  
+  app_timer_register(AUTOSAVE_PERIOD, autosave, NULL);
+}
+
+// Decode an image block from the given banks, returning false if it is missing or corrupt
+static bool load_block(uint32_t key, uint16_t bank_mask, int block, uint8_t *bytes) {
+  uint32_t bkey = block_key(key, bank_mask, block);
+  int len = persist_exists(bkey) ? persist_read_data(bkey, s_block_buf, sizeof(s_block_buf)) : 0;
+  
+  if (len <= 0 || !imgcodec_decode_rows(s_block_buf, len, bytes + (block * IMG_BLOCK_BYTES), IMG_BLOCK_ROWS)) {
+    memset(bytes + (block * IMG_BLOCK_BYTES), 0xFF, IMG_BLOCK_BYTES);
+    return false;
+  }
+  return true;
+}
+
+// Read one of a drawing's image headers, returning false if it doesn't exist
+static bool read_header(uint32_t key, int index, ImageHeader *header) {
+  uint32_t hkey = key + HEADER_KEY_OFFSET + index;
+  return persist_exists(hkey) && persist_get_size(hkey) == sizeof(ImageHeader) && 
+    persist_read_data(hkey, header, sizeof(ImageHeader)) == sizeof(ImageHeader);
+}
+
+// Start loading a drawing's pixel data from the watch storage into the (already initialized) image.
+// The blocks are then loaded a few at a time by load_image_step
+static void begin_load_image(uint8_t slot, uint8_t *bytes) {
+  uint32_t key = drawing_key(slot);
+  ImageHeader headers[2];
+  bool has_header[2];
+  
+  s_load_key = key;
+  s_load_block = 0;
+  s_load_try = 0;
+  s_load_ok = true;
+  s_load_verify = true;
+  s_load_damaged = false;
+  
+  has_header[0] = read_header(key, 0, &headers[0]);
+  has_header[1] = read_header(key, 1, &headers[1]);
+  
+  if (has_header[0] && has_header[1]) {
+    // Try the latest save first, falling back to the save before it if it is incomplete
+    int latest = (headers[1].generation > headers[0].generation) ? 1 : 0;
+    s_load_headers[0] = headers[latest];
+    s_load_headers[1] = headers[!latest];
+    s_load_count = 2;
+  } else if (has_header[0] || has_header[1]) {
+    s_load_headers[0] = headers[has_header[0] ? 0 : 1];
+    s_load_count = 1;
+  } else if (slot > 0 || persist_read_int(IMAGEFORMAT_KEY) == IMAGE_FORMAT_RLE) {
+    // Image was saved compressed before saves had headers (all blocks in the first bank)
+    memset(&s_load_headers[0], 0, sizeof(ImageHeader));
+    s_load_count = 1;
+    s_load_verify = false;
+  } else {
+    // Image was saved uncompressed by an older version (always in the first slot)
+    for (int s = 0; s < (IMG_PIXELS / PERSIST_SIZE_MAX); s++) {
+      if (persist_exists(key + s)) {
+        persist_read_data(key + s, bytes + (s * PERSIST_SIZE_MAX), PERSIST_SIZE_MAX);
       }
-      // Store remainder pixels
-      persist_write_data(IMAGEDATA_START_KEY + (IMG_PIXELS / PERSIST_SIZE_MAX), 
-                         bytes + ((IMG_PIXELS / PERSIST_SIZE_MAX) * PERSIST_SIZE_MAX), 
-                         IMG_PIXELS % PERSIST_SIZE_MAX); 
-      s_changed = false;
     }
+    if (persist_exists(key + (IMG_PIXELS / PERSIST_SIZE_MAX)))
+      persist_read_data(key + (IMG_PIXELS / PERSIST_SIZE_MAX), 
+                        bytes + ((IMG_PIXELS / PERSIST_SIZE_MAX) * PERSIST_SIZE_MAX), 
+                        IMG_PIXELS % PERSIST_SIZE_MAX);
+    
+    memset(&s_image_header, 0, sizeof(s_image_header));
+    // Rewrite the whole image compressed on the next save
+    mark_imagedata_dirty();
+    s_load_count = 0;
+    s_load_block = IMG_BLOCKS;
+  }
+}
+
+// Load the next few blocks of the image, returning true once the whole image is loaded
+static bool load_image_step(uint8_t *bytes, int blocks) {
+  if (s_load_count == 0) return true;
+  
+  ImageHeader *header = &s_load_headers[s_load_try];
+  
+  for (; blocks > 0 && s_load_block < IMG_BLOCKS; blocks--, s_load_block++) {
+    if (!load_block(s_load_key, header->bank_mask, s_load_block, bytes)) s_load_ok = false;
+  }
+  if (s_load_block < IMG_BLOCKS) return false;
+  
+  if (!s_load_verify || (s_load_ok && imgcodec_checksum(bytes, IMG_PIXELS) == header->checksum)) {
+    // Loaded a good (or unchecked) save
+    s_image_header = *header;
+    if (!s_load_ok) APP_LOG(APP_LOG_LEVEL_WARNING, "Image is incomplete");
+    if (s_load_try > 0 && !s_load_damaged) APP_LOG(APP_LOG_LEVEL_WARNING, "Latest image save is damaged - loaded previous save");
+    if (s_load_damaged) mark_imagedata_dirty();
+    
+    // Thumbnail may be missing if a save was interrupted (or the image is from before the gallery)
+    if (!persist_exists(s_load_key + THUMB_KEY_OFFSET))
+      save_thumb((s_load_key - IMAGEDATA_START_KEY) / DRAWING_KEY_SPAN, bytes);
+    
+    s_load_count = 0;
+    return true;
+  }
+  
+  // Try the previous save, or if neither save checks out keep what can be read of the latest
+  // (and rewrite all of it on the next save)
+  if (s_load_try + 1 < s_load_count) {
+    s_load_try++;
+  } else {
+    APP_LOG(APP_LOG_LEVEL_WARNING, "Image saves are damaged");
+    s_load_try = 0;
+    s_load_verify = false;
+    s_load_damaged = true;
+  }
+  s_load_block = 0;
+  s_load_ok = true;
+  return false;
+}
+
+// Load a drawing's pixel data from the watch storage into the (already initialized) image
+static void load_image(uint8_t slot, uint8_t *bytes) {
+  begin_load_image(slot, bytes);
+  while (!load_image_step(bytes, IMG_BLOCKS));
+}
+
+// Read a drawing's thumbnail from the watch storage (for the gallery window)
+static bool read_thumb(uint8_t index, uint8_t *thumb) {
+  uint32_t key = drawing_key(s_gallery.slots[index]) + THUMB_KEY_OFFSET;
+  if (!persist_exists(key)) return false;
+  
+  int len = persist_read_data(key, s_block_buf, sizeof(s_block_buf));
+  return len > 0 && imgcodec_decode_thumb(s_block_buf, len, thumb);
+}
+
+// Switch to another drawing from the gallery (-1 starts a new drawing), returning false if the
+// current drawing couldn't be saved (so it is kept open rather than losing its changes)
+static bool open_drawing(int8_t index) {
+  if (index >= 0 && index == s_gallery.current) return true;
+  
+  // Keep any changes to the current drawing
+  if (!save_image(false)) return false;
+  
+  reset_image();
+  clear_dirty_imagedata();
+  memset(&s_image_header, 0, sizeof(s_image_header));
+  s_gallery.current = index;
+  save_gallery();
+  
+  if (index >= 0) {
+    init_imagedata();
+    uint8_t *bytes = get_imagedata();
+    if (bytes != NULL) load_image(s_gallery.slots[index], bytes);
+  }
+  return true;
+}
+
+// Delete a drawing from the gallery, starting a new drawing if it is the current one
+static void gallery_delete(uint8_t index) {
+  if (index == s_gallery.current) {
+    reset_image();
+    clear_dirty_imagedata();
+  }
+  delete_drawing(index);
+}
+
+// Save the current drawing (so its thumbnail is up to date) and show the gallery
+static void show_drawings(void) {
+  // The gallery is still shown if the save failed, as deleting drawings may make room for it
+  bool saved = save_image(true);
+  show_gallery(&s_gallery, open_drawing, gallery_delete, read_thumb);
+  if (!saved) show_msg(s_save_error, false, 10);
+}
+
+static void send_timer_fired(void *data) {
+  s_send_timer = NULL;
+  send_image_chunk(NULL);
+}
+
+// Send the next chunk after a delay (replacing any chunk already waiting to be sent, so only one
+// chunk is ever in the outbox)
+static void schedule_chunk(uint32_t delay) {
+  if (s_send_timer != NULL) app_timer_cancel(s_send_timer);
+  s_send_timer = app_timer_register(delay, send_timer_fired, NULL);
+}
+
+static void cancel_chunk_timer(void) {
+  if (s_send_timer != NULL) {
+    app_timer_cancel(s_send_timer);
+    s_send_timer = NULL;
+  }
+}
+
+// Stop sending the image and free the chunk buffer
+static void end_send(void) {
+  cancel_chunk_timer();
+  s_sending_image = false;
+  s_send_waiting = false;
+  if (s_chunk_buf != NULL) {
+    heap_free(s_chunk_buf, s_chunk_size);
+    s_chunk_buf = NULL;
+  }
+}
+
+// Indicates if a row is being sent
+static bool is_send_row(int y) {
+  return (y >= 0) && (y < IMG_HEIGHT) && (s_send_rows[y / 8] & (1 << (y % 8)));
+}
+
+// Add the next row to send to the chunk, with a range header if it starts a range of rows
+// (returns the bytes added, or 0 if there isn't room)
+static int add_send_row(uint8_t *bytes, uint8_t *dest, int room) {
+  int len = 0;
+  
+  if (room < RANGE_HEADER_SIZE + IMG_ROW_MAX_ENCODED) return 0;
+  
+  if (!is_send_row(s_send_row - 1)) {
+    int count = 1;
+    while (is_send_row(s_send_row + count)) count++;
+    dest[len++] = s_send_row;
+    dest[len++] = count;
+  }
+  
+  uint8_t *row = bytes + (s_send_row * IMG_ROW_BYTES);
+  len += imgcodec_encode_row(row, is_send_row(s_send_row - 1) ? (row - IMG_ROW_BYTES) : NULL, dest + len);
+  return len;
+}
+
+// Move on to the next row to send (IMG_HEIGHT if there are no more)
+static void next_send_row(void) {
+  do {
+    s_send_row++;
+  } while (s_send_row < IMG_HEIGHT && !is_send_row(s_send_row));
+}
+
+// Start (or restart) sending from the beginning of the image, working out which rows the phone
+// doesn't have
+static void restart_send(uint8_t *bytes) {
+  s_send_checksum = imgcodec_checksum(bytes, IMG_PIXELS);
+  s_send_full = true;
+  
+  memset(s_send_rows, 0, sizeof(s_send_rows));
+  for (int y = 0; y < IMG_HEIGHT; y++) {
+    if (s_sent_hashes == NULL || stream_is_row_drawn(y) || 
+        s_sent_hashes[y] != imgcodec_row_hash(bytes + (y * IMG_ROW_BYTES)))
+      s_send_rows[y / 8] |= 1 << (y % 8);
+    else
+      s_send_full = false;
+  }
+  
+  // Work out the data length up front so the phone can allocate all of it
+  s_send_length = 0;
+  s_send_row = 0;
+  if (!is_send_row(0)) next_send_row();
+  for (; s_send_row < IMG_HEIGHT; next_send_row()) {
+    s_send_length += add_send_row(bytes, s_chunk_buf, s_chunk_size);
   }
+  
+  s_send_row = 0;
+  if (!is_send_row(0)) next_send_row();
+  s_send_offset = 0;
+  s_acked_row = s_send_row;
+  s_acked_offset = 0;
 }
 
 // Send a chunk of image pixel data to the phone (ignore *data parameter, used as timer procdure)
-// (app message outbox has a limit of just over 512 bytes so the image must be sent in chunks)
-static void send_image_chunk(void *data) {
-  // Get the pixel bytes chunk start position
-  void *bytes = get_imagedata() + s_chunk_pos;
+// Each chunk has as many compressed rows as fit in the app message outbox
+static void send_next_chunk(void) {
+  uint8_t *bytes = get_imagedata();
   
-  // Assume max chunk size
-  int len = IMAGE_CHUNK_SIZE;
+  if (!s_sending_image || bytes == NULL) {
+    end_send();
+    return;
+  }
   
-  // Indicate if 1st or one of many middle chunk
-  int chunk_status_flag = (s_chunk_pos == 0) ? FIRST_CHUNK : MID_CHUNK;
+  // Wait for a batch of strokes to finish sending
+  if (s_stream_sending) {
+    schedule_chunk(SEND_RETRY_DELAY);
+    return;
+  }
+  
+  // Resume from what the phone has received (the image is resent if it was changed)
+  s_send_row = s_acked_row;
+  s_send_offset = s_acked_offset;
+  if (s_send_restart || imgcodec_checksum(bytes, IMG_PIXELS) != s_send_checksum) {
+    APP_LOG(APP_LOG_LEVEL_DEBUG, "Image changed while sending - restarting");
+    s_send_restart = false;
+    restart_send(bytes);
+  }
   
-  if (s_chunk_pos + len > IMG_PIXELS) {
-    // If chunk goes past end of pixel array, only send remainder as last chunk
-    len = IMG_PIXELS - s_chunk_pos;
-    chunk_status_flag = LAST_CHUNK;
+  // Fill the chunk with as many whole compressed rows as fit
+  int len = 0;
+  while (s_send_row < IMG_HEIGHT) {
+    int row_len = add_send_row(bytes, s_chunk_buf + len, s_chunk_size - len);
+    if (row_len == 0) break;
+    len += row_len;
+    next_send_row();
   }
   
+  // Indicate if 1st, one of many middle, or last chunk
+  int chunk_status_flag;
+  if (s_send_row >= IMG_HEIGHT)
+    chunk_status_flag = (s_send_offset == 0) ? ONLY_CHUNK : LAST_CHUNK;
+  else
+    chunk_status_flag = (s_send_offset == 0) ? FIRST_CHUNK : MID_CHUNK;
+  
   // Setup tuplets for sending data to phone
-  Tuplet data_chunk = TupletBytes(IMAGE_DATA_SEND_KEY, bytes, len);
+  Tuplet data_chunk = TupletBytes(IMAGE_DATA_SEND_KEY, s_chunk_buf, len);
   Tuplet chunk_status = TupletInteger(CHUNK_STATUS_KEY, chunk_status_flag);
+  Tuplet image_format = TupletInteger(IMAGE_FORMAT_SEND_KEY, IMAGE_FORMAT_ROWS);
+  Tuplet chunk_offset = TupletInteger(CHUNK_OFFSET_KEY, s_send_offset);
+  Tuplet image_length = TupletInteger(IMAGE_LENGTH_KEY, s_send_length);
+  // Only changed rows are being sent, so the phone must have the image they are changes to
+  Tuplet base_checksum = TupletInteger(BASE_CHECKSUM_KEY, s_sent_checksum);
   
   DictionaryIterator *iter;
   app_message_outbox_begin(&iter);
 
   if (iter == NULL) {
     APP_LOG(APP_LOG_LEVEL_DEBUG, "Send image chunk iter is NULL");
-    s_sending_image = false;
+    end_send();
+    stream_resync();
+    if (!s_send_quiet) show_msg("Sending failed\n(Phone busy)", true, 15);
     return;
   }
 
   dict_write_tuplet(iter, &data_chunk);
   dict_write_tuplet(iter, &chunk_status);
+  dict_write_tuplet(iter, &image_format);
+  dict_write_tuplet(iter, &chunk_offset);
+  dict_write_tuplet(iter, &image_length);
+  if (!s_send_full) dict_write_tuplet(iter, &base_checksum);
   dict_write_end(iter);
   
-  APP_LOG(APP_LOG_LEVEL_DEBUG, "Sending image chunk - Pos: %d, Len: %d", s_chunk_pos, len);
+  APP_LOG(APP_LOG_LEVEL_DEBUG, "Sending image chunk - Offset: %d, Len: %d", s_send_offset, len);
+  s_send_offset += len;
   // Finally, send image chunk
   app_message_outbox_send();
 }
 
+// Send the next chunk of the image (or wait to)
+static void send_image_chunk(void *data) {
+  cancel_chunk_timer();
+  profile_start(PROFILE_SEND_CHUNK);
+  send_next_chunk();
+  profile_end(PROFILE_SEND_CHUNK);
+}
+
+// Remember what the phone has after it received the whole image
+static void image_sent(uint8_t *bytes) {
+  if (s_sent_hashes == NULL) s_sent_hashes = heap_malloc(IMG_HEIGHT * sizeof(uint32_t));
+  if (s_sent_hashes == NULL) return;
+  
+  for (int y = 0; y < IMG_HEIGHT; y++) {
+    s_sent_hashes[y] = imgcodec_row_hash(bytes + (y * IMG_ROW_BYTES));
+  }
+  s_sent_checksum = s_send_checksum;
+  stream_clear_drawn_rows();
+}
+
+// Forget what the phone has, so the whole image is sent next time
+static void forget_sent_image(void) {
+  if (s_sent_hashes != NULL) {
+    heap_free(s_sent_hashes, IMG_HEIGHT * sizeof(uint32_t));
+    s_sent_hashes = NULL;
+  }
+}
+
 // Event fired when send failed
 static void send_image_chunk_failed(DictionaryIterator *iter, AppMessageResult reason, void *context) {
   APP_LOG(APP_LOG_LEVEL_DEBUG, "Send image chunk failed: %d", reason);
-  s_sending_image = false;
-  // Show error message for 15 seconds
-  snprintf(s_msg, sizeof(s_msg), "Sending failed\n(Error: %d)", reason);
-  show_msg(s_msg, true, 15);
+  if (!s_sending_image) return;
+  
+  if (s_send_retries < MAX_SEND_RETRIES) {
+    // Resend from the last chunk the phone received, waiting longer after each failure
+    schedule_chunk(SEND_RETRY_DELAY << s_send_retries);
+    s_send_retries++;
+  } else if (!bluetooth_connection_service_peek()) {
+    // Phone is gone, so carry on when it reconnects
+    s_send_waiting = true;
+    if (!s_send_quiet) show_msg("Sending paused.\nWill resume when the phone reconnects.", false, 15);
+  } else {
+    end_send();
+    // Strokes sent since the send started were drawn on the image the phone already had
+    stream_resync();
+    if (s_send_quiet) return;
+    // Show error message for 15 seconds
+    snprintf(s_msg, sizeof(s_msg), "Sending failed\n(Error: %d)", reason);
+    show_msg(s_msg, true, 15);
+  }
 }
 
 // Event fired when image chunk succesfully sent
 static void sent_image_chunk(DictionaryIterator *iter, void *context) {
-  if (s_sending_image && s_chunk_pos + IMAGE_CHUNK_SIZE < IMG_PIXELS) {
-    // If there is more to send, send it
-    s_chunk_pos += IMAGE_CHUNK_SIZE;
-    snprintf(s_msg, sizeof(s_msg), "Sending to Phone...\n%d%%", (int)divide(s_chunk_pos * 100, IMG_PIXELS));
-    show_msg(s_msg, true, 0);
-    // Send next chunk after brief delay to allow display to update
-    app_timer_register(15, send_image_chunk, NULL);
+  if (!s_sending_image) return;
+  
+  // Phone has everything up to the end of this chunk
+  s_acked_row = s_send_row;
+  s_acked_offset = s_send_offset;
+  s_send_retries = 0;
+  
+  if (s_acked_row < IMG_HEIGHT || s_send_restart) {
+    // If there is more to send, send it straight away, only updating the progress in large steps
+    int progress = (int)divide(s_acked_offset * 100, s_send_length);
+    if (!s_send_quiet && progress >= s_send_progress + SEND_PROGRESS_STEP) {
+      s_send_progress = progress;
+      snprintf(s_msg, sizeof(s_msg), "Sending to Phone...\n%d%%", progress);
+      show_msg(s_msg, true, 0);
+    }
+    send_image_chunk(NULL);
   } else {
     // Else sent all chunks, so stop sending and show Sent message for 15 seconds
-    s_sending_image = false;
-    show_msg("Sent to Phone.\nGo to Draw app Settings in Pebble phone app to view.", false, 15);
+    image_sent(get_imagedata());
+    end_send();
+    if (!s_send_quiet) show_msg("Sent to Phone.\nGo to Draw app Settings in Pebble phone app to view.", false, 15);
   }
 }
 
-// Start sending the image data to the phone
-static void send_image(void) {
-  if (get_imagedata() == NULL) {
+// Resume sending the image when the phone reconnects
+static void bluetooth_handler(bool connected) {
+  if (connected && s_sending_image && s_send_waiting) {
+    s_send_waiting = false;
+    s_send_retries = 0;
+    if (!s_send_quiet) show_msg("Sending to Phone...", true, 0);
+    schedule_chunk(SEND_RETRY_DELAY);
+  }
+}
+
+// Start sending the image data to the phone. Quiet sends keep the phone up to date for live sync,
+// so don't show any messages
+static void start_send(bool quiet) {
+  uint8_t *bytes = get_imagedata();
+  
+  if (bytes == NULL) {
     // No image data
-    show_msg("No image to send.\nPress Back and then Select button to start drawing", false, 5);
+    if (!quiet) show_msg("No image to send.\nPress Back and then Select button to start drawing", false, 5);
+    return;
+  }
+  
+  if (s_sending_image) {
+    // Already sending (to keep up live sync), so just show the progress from now on. The send
+    // restarts by itself if the image changes
+    if (!quiet && s_send_quiet) {
+      s_send_quiet = false;
+      s_send_progress = 0;
+      show_msg(s_send_waiting ? "Sending paused.\nWill resume when the phone reconnects." : "Sending to Phone...", 
+               !s_send_waiting, s_send_waiting ? 15 : 0);
+    }
+    return;
+  }
+  
+  if (s_stream_sending) {
+    // Only one message can be sent at once, so start once the strokes have been sent
+    s_send_pending_quiet = (s_send_pending ? s_send_pending_quiet : true) && quiet;
+    s_send_pending = true;
+    if (!quiet) show_msg("Sending to Phone...", true, 0);
+    return;
+  }
+  
+  // Chunk size is what is left of the outbox after the other values
+  end_send();
+  uint32_t outbox_size = app_message_outbox_size_maximum();
+  uint32_t overhead = dict_calc_buffer_size(6, 0, sizeof(int32_t), sizeof(int32_t), sizeof(int32_t), 
+                                           sizeof(int32_t), sizeof(int32_t));
+  s_chunk_size = (outbox_size > overhead + RANGE_HEADER_SIZE + IMG_ROW_MAX_ENCODED) ? 
+    (outbox_size - overhead) : (RANGE_HEADER_SIZE + IMG_ROW_MAX_ENCODED);
+  s_chunk_buf = heap_malloc(s_chunk_size);
+  
+  if (s_chunk_buf == NULL) {
+    if (!quiet) show_msg("Not enough memory to send image", false, 5);
+    return;
+  }
+  heap_log("send");
+  
+  // If have image data, start sending. Strokes drawn from now on are drawn on the phone after the image
+  restart_send(bytes);
+  stream_resync_started();
+  if (s_send_length == 0) {
+    end_send();
+    if (!quiet) show_msg("Phone already has this image.\nGo to Draw app Settings in Pebble phone app to view.", false, 5);
+    return;
+  }
+  s_send_restart = false;
+  s_send_retries = 0;
+  s_send_progress = 0;
+  s_send_quiet = quiet;
+  s_sending_image = true;
+  if (quiet) {
+    send_image_chunk(NULL);
   } else {
-    // If have image data, start sending
-    s_chunk_pos = 0;
-    s_sending_image = true;
     show_msg("Sending to Phone...\n0%", true, 0);
     // Start sending after a brief delay to allow message to display
-    app_timer_register(300, send_image_chunk, NULL);
+    schedule_chunk(300);
+  }
+}
+
+// Send the image to the phone (from settings)
+static void send_image(void) {
+  start_send(false);
+}
+
+// Send a batch of the strokes drawn to the phone
+static void send_strokes(void) {
+  uint16_t len = stream_take(s_stroke_buf, sizeof(s_stroke_buf));
+  if (len == 0) return;
+  
+  DictionaryIterator *iter;
+  app_message_outbox_begin(&iter);
+  
+  if (iter == NULL) {
+    stream_strokes_lost();
+    return;
+  }
+  
+  dict_write_data(iter, STROKE_DATA_KEY, s_stroke_buf, len);
+  dict_write_end(iter);
+  s_stream_sending = true;
+  app_message_outbox_send();
+}
+
+// Start a send that was waiting for the outbox
+static void start_pending_send(void) {
+  if (s_send_pending) {
+    s_send_pending = false;
+    start_send(s_send_pending_quiet);
+  }
+}
+
+// Keep the phone's image up to date for live sync: send the strokes drawn since the last batch, or
+// the changed rows of the image if the strokes can't be used (only between strokes, as the image
+// must not change much while it is sent)
+static void stream_timer(void *data) {
+  s_stream_timer = NULL;
+  if (!stream_is_enabled()) return;
+  
+  if (s_send_pending && !s_stream_sending) {
+    // Start a send that came in while strokes were being sent, if the outbox events didn't
+    start_pending_send();
+  } else if (!s_sending_image && !s_stream_sending && bluetooth_connection_service_peek()) {
+    StreamResync resync = stream_resync_needed();
+    
+    if (resync == STREAM_RESYNC_NONE) {
+      send_strokes();
+    } else if (!is_pen_down() && !is_eraser_on()) {
+      if (resync == STREAM_RESYNC_FULL) forget_sent_image();
+      start_send(true);
+    }
   }
+  
+  s_stream_timer = app_timer_register(STREAM_PERIOD, stream_timer, NULL);
+}
+
+// Start sending strokes if live sync is on
+static void start_stream_timer(void) {
+  if (stream_is_enabled() && s_stream_timer == NULL)
+    s_stream_timer = app_timer_register(STREAM_PERIOD, stream_timer, NULL);
+}
+
+// Event fired when a message was sent, for either a batch of strokes or an image chunk
+static void outbox_sent(DictionaryIterator *iter, void *context) {
+  if (s_stream_sending) {
+    s_stream_sending = false;
+    start_pending_send();
+  } else {
+    sent_image_chunk(iter, context);
+  }
+}
+
+// Event fired when a message failed to send
+static void outbox_failed(DictionaryIterator *iter, AppMessageResult reason, void *context) {
+  if (s_stream_sending) {
+    APP_LOG(APP_LOG_LEVEL_DEBUG, "Send strokes failed: %d", reason);
+    s_stream_sending = false;
+    stream_strokes_lost();
+    start_pending_send();
+  } else {
+    send_image_chunk_failed(iter, reason, context);
+  }
+}
+
+// Handle messages from the phone
+static void inbox_received(DictionaryIterator *iter, void *context) {
+  if (dict_find(iter, RESYNC_KEY) != NULL) {
+    // Phone doesn't have the image the changed rows were for, so send it all
+    APP_LOG(APP_LOG_LEVEL_DEBUG, "Phone asked for the whole image");
+    forget_sent_image();
+    if (s_sending_image)
+      s_send_restart = true;
+    else if (stream_is_enabled())
+      // Live sync sends it between strokes
+      stream_strokes_lost();
+    else
+      send_image();
+  }
+}
+
+// Event fired when info window is closed
+static void info_closed(void) {
+  // Re-center cursor on closing info window so it is centered when used is looking at watch
+  tracking_recenter();
+  trace_event(TRACE_RECENTER, 0);
+}
+
+// Show info window to explain buttons (from settings)
+static void show_help(void) {
+  show_infowin(info_closed);
 }
 
 // Handle Up button clicks
 static void up_click_handler(ClickRecognizerRef recognizer, void *context) {
-  // Pause drawing and reset center (accel handler will re-center when s_centered == false)
+  // Pause drawing and reset center (accel handler will re-center on the next batch)
+  trace_event(TRACE_UP_CLICK, 0);
   set_paused();
-  s_centered = false;
+  tracking_recenter();
 }
 
 // Handle Select button clicks
 static void select_click_handler(ClickRecognizerRef recognizer, void *context) {
-  // Mark image as changed and toggle 'pen' on/off
-  s_changed = true;
+  // Toggle 'pen' on/off
+  trace_event(TRACE_SELECT_CLICK, 0);
   toggle_pen();
 }
 
 // Handle holding Select button
 static void select_hold_handler(ClickRecognizerRef recognizer, void *context) {
-  // Mark image as changed and toggle 'eraser' on/off
-  s_changed = true;
+  // Toggle 'eraser' on/off
+  trace_event(TRACE_SELECT_HOLD, 0);
   toggle_eraser();
 }
 
 // Handle Down button clicks
 static void down_click_handler(ClickRecognizerRef recognizer, void *context) {
   // Pause drawing and show settings window
+  trace_event(TRACE_DOWN_CLICK, 0);
   set_paused();
-  show_settings(&s_settings, send_image, clear_image, settings_closed);
+  show_settings(&s_settings, send_image, clear_image, show_drawings, show_help, settings_closed);
 }
   
 // Trap single clicks
@@ -361,40 +1052,103 @@ static void click_config_provider(void *context) {
 // Handle app focus changes
 static void focus_handler(bool in_focus) {
   // Pause drawing if we lose focus (notification)
+  trace_event(TRACE_FOCUS, in_focus);
   if (!in_focus) set_paused();
   s_infocus = in_focus;
 }
 
 // Handle 'tap' event when watch is sharply shaken/tapped
 static void tap_handler(AccelAxisType axis, int32_t direction) {
+  trace_event(TRACE_TAP, axis);
   if (!is_pen_down() && axis == ACCEL_AXIS_Y && s_infocus && is_canvas_on_top()) {
     // If not drawing and tap was in y plane and app is in focus and canvase is showing, clear image
-    s_changed = true;
-    if (has_undo())
+    // The first shake undoes the last change, and the shake after an undo clears the image or
+    // undoes the undo (as the Second Shake setting says)
+    if (s_shake_undid) {
+      s_shake_undid = false;
+      if (s_settings.secondshake_clear)
+        clear_image();
+      else if (has_redo())
+        redo_image();
+    } else if (has_undo()) {
       undo_image();
-    else if (s_settings.secondshake_clear)
+      s_shake_undid = true;
+    } else if (s_settings.secondshake_clear) {
       clear_image();
+    }
   }
 }
 
-// Event fired when info window is closed
-static void info_closed(void) {
-  // Re-center cursor on closing info window so it is centered when used is looking at watch
-  s_centered = false;
-}
-
 // Event fired when 'pen' status changes
 static void pen_status_changed(bool pen_down, bool eraser_on) {
+  // Drawing starts a new change for the next shake to undo
+  if (pen_down || eraser_on) s_shake_undid = false;
   light_control(s_settings.backlight_alwayson && (pen_down || eraser_on));
 }
 
 // Event fired when canvas window closes
 static void canvas_closed(void) {
-  // Save image data to watch storage
-  save_image();
+  // Save image data to watch storage (the app is closing, so there is no showing a message)
+  save_image(true);
+}
+
+// Finish starting up once the image has loaded
+static void finish_startup(void) {
+  APP_LOG(APP_LOG_LEVEL_DEBUG, "Image loaded after %d ms", (int)(get_time_ms() - s_startup_time));
+  
+  // Subscribe to events
+  init_click_events(click_config_provider);
+  accel_data_service_subscribe(ACCEL_BATCH_SIZE, accel_handler);
+  accel_service_set_sampling_rate(ACCEL_SAMPLING_50HZ);
+  app_focus_service_subscribe(focus_handler);
+  accel_tap_service_subscribe(tap_handler);
+  
+  // Save changes periodically so little is lost if the app is killed
+  app_timer_register(AUTOSAVE_PERIOD, autosave, NULL);
+  
+  // Init app message for sending image to phone
+  app_message_register_outbox_sent(outbox_sent);
+  app_message_register_outbox_failed(outbox_failed);
+  app_message_register_inbox_received(inbox_received);
+  app_message_open(64, app_message_outbox_size_maximum());
+  bluetooth_connection_service_subscribe(bluetooth_handler);
+  start_stream_timer();
+  
+  // Show info window to explain buttons the first time the app is run (available from settings after)
+  if (!persist_exists(INFOSHOWN_KEY)) {
+    show_infowin(info_closed);
+    persist_write_bool(INFOSHOWN_KEY, true);
+  }
+  
+  APP_LOG(APP_LOG_LEVEL_DEBUG, "Startup finished after %d ms", (int)(get_time_ms() - s_startup_time));
+}
+
+// Load the image a few blocks at a time, so the canvas shows (and updates) while it loads
+static void startup_step(void *data) {
+  uint8_t *bytes = get_imagedata();
+  
+  if (s_gallery.current >= 0 && bytes != NULL) {
+    uint8_t from = s_load_block;
+    bool loaded = load_image_step(bytes, LOAD_BLOCKS_PER_STEP);
+    
+    if (loaded) {
+      redraw_imagedata(0, IMG_PIXELS);
+    } else {
+      if (s_load_block > from)
+        redraw_imagedata(from * IMG_BLOCK_BYTES, (s_load_block - from) * IMG_BLOCK_BYTES);
+      app_timer_register(STARTUP_STEP_DELAY, startup_step, NULL);
+      return;
+    }
+  }
+  
+  finish_startup();
 }
 
+// Show the canvas first and read the settings, then load the image and finish starting up in steps
 static void init(void) {
+  s_startup_time = get_time_ms();
+  profile_start(PROFILE_INIT);
+  trace_start();
   
   // Show the main screen and update the UI
   show_canvas(pen_status_changed, canvas_closed);
@@ -430,43 +1184,58 @@ static void init(void) {
   else
     s_settings.pen_width = 1;
   
+  if (persist_exists(ERASERSHAPE_KEY))
+    s_settings.eraser_round = persist_read_bool(ERASERSHAPE_KEY);
+  else
+    s_settings.eraser_round = false;
+  
+  if (persist_exists(SMOOTHING_KEY))
+    s_settings.adaptive_smoothing = persist_read_bool(SMOOTHING_KEY);
+  else
+    s_settings.adaptive_smoothing = false;
+  
+  if (persist_exists(EVERYSAMPLE_KEY))
+    s_settings.every_sample = persist_read_bool(EVERYSAMPLE_KEY);
+  else
+    s_settings.every_sample = false;
+  
+  if (persist_exists(LIVESYNC_KEY))
+    s_settings.live_sync = persist_read_bool(LIVESYNC_KEY);
+  else
+    s_settings.live_sync = false;
+  
   load_settings();
   
-  // If saved, load image data from storage
-  if (persist_exists(IMAGEDATA_START_KEY)) {
+  // Get the index of saved drawings
+  if (persist_exists(GALLERY_KEY)) {
+    persist_read_data(GALLERY_KEY, &s_gallery, sizeof(s_gallery));
+  } else if (persist_exists(IMAGEDATA_START_KEY)) {
+    // Image was saved before the gallery existed
+    s_gallery.count = 1;
+    s_gallery.current = 0;
+    s_gallery.slots[0] = 0;
+  } else {
+    s_gallery.count = 0;
+    s_gallery.current = -1;
+  }
+  
+  // If saved, load the current drawing from storage (after the canvas has shown)
+  if (s_gallery.current >= 0) {
     APP_LOG(APP_LOG_LEVEL_DEBUG, "Storage has image data - Initializing image");
     
     init_imagedata();
-    void *bytes = get_imagedata();
+    uint8_t *bytes = get_imagedata();
     
     if (bytes != NULL) {
       APP_LOG(APP_LOG_LEVEL_DEBUG, "Image initialized - reading image data");
-      for (int s = 0; s < (IMG_PIXELS / PERSIST_SIZE_MAX); s++) {
-        if (persist_exists(IMAGEDATA_START_KEY + s)) {
-          persist_read_data(IMAGEDATA_START_KEY + s, bytes + (s * PERSIST_SIZE_MAX), PERSIST_SIZE_MAX);
-        }
-      }
-      if (persist_exists(IMAGEDATA_START_KEY + (IMG_PIXELS / PERSIST_SIZE_MAX)))
-        persist_read_data(IMAGEDATA_START_KEY + (IMG_PIXELS / PERSIST_SIZE_MAX), 
-                          bytes + ((IMG_PIXELS / PERSIST_SIZE_MAX) * PERSIST_SIZE_MAX), 
-                          IMG_PIXELS % PERSIST_SIZE_MAX);
+      begin_load_image(s_gallery.slots[s_gallery.current], bytes);
     }
   }
   
-  // Subscribe to events
-  init_click_events(click_config_provider);
-  accel_data_service_subscribe(5, accel_handler);
-  accel_service_set_sampling_rate(ACCEL_SAMPLING_50HZ);
-  app_focus_service_subscribe(focus_handler);
-  accel_tap_service_subscribe(tap_handler);
+  APP_LOG(APP_LOG_LEVEL_DEBUG, "Settings read after %d ms", (int)(get_time_ms() - s_startup_time));
   
-  // Show info window to explain buttons
-  show_infowin(info_closed);
-  
-  // Init app message for sending image to phone
-  app_message_register_outbox_sent(sent_image_chunk);
-  app_message_register_outbox_failed(send_image_chunk_failed);
-  app_message_open(64, app_message_outbox_size_maximum());
+  app_timer_register(STARTUP_STEP_DELAY, startup_step, NULL);
+  profile_end(PROFILE_INIT);
 }
 
 static void deinit(void) {
@@ -474,9 +1243,14 @@ static void deinit(void) {
   accel_data_service_unsubscribe();
   app_focus_service_unsubscribe();
   accel_tap_service_unsubscribe();
+  bluetooth_connection_service_unsubscribe();
+  end_send();
+  forget_sent_image();
   light_enable(false);
   
   hide_canvas();
+  trace_flush();
+  profile_log();
 }
 
 int main(void) {
@@ -1,5 +1,6 @@
 #include "msg.h"
 #include <pebble.h>
+#include "heap.h"
 
 // Simple message window that can be set not to close on the back button (modal = true)
   
@@ -13,7 +14,7 @@ static GFont s_res_gothic_24_bold;
 static TextLayer *msg_layer;
 
 static void initialise_ui(void) {
-  s_window = window_create();
+  s_window = heap_window_create();
   window_set_fullscreen(s_window, true);
   
   s_res_gothic_24_bold = fonts_get_system_font(FONT_KEY_GOTHIC_24_BOLD);
@@ -26,7 +27,7 @@ static void initialise_ui(void) {
 }
 
 static void destroy_ui(void) {
-  window_destroy(s_window);
+  heap_window_destroy(s_window);
   text_layer_destroy(msg_layer);
 }
 // END AUTO-GENERATED UI CODE
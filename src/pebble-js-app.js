@@ -1,121 +1,598 @@
 var DEBUG = false;
+var IMAGE_FILE_TYPE = 'png';  // Image file type shown in the settings page ('png' is smaller, or 'bmp')
 
-var ChunkStatusEnum = {FIRST_CHUNK: 1, MID_CHUNK: 2, LAST_CHUNK: 3};
+var ChunkStatusEnum = {FIRST_CHUNK: 1, MID_CHUNK: 2, LAST_CHUNK: 3, ONLY_CHUNK: 4};
+var ImageFormatEnum = {RAW: 0, RLE: 1, ROWS: 2};
 
-var image_data = [];
+var IMG_WIDTH = 144;
+var IMG_ROW_BYTES = 20;
+var IMG_HEIGHT = 168;
+var IMG_PIXELS = IMG_ROW_BYTES * IMG_HEIGHT;
+
+// Stored images are this tag followed by the pixels in base64 (older versions stored a JSON array)
+var STORAGE_VERSION = 'v2:';
+var BASE64_CHARS = 'ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/';
+
+var image_data = null;
 var chunk_status = 0;
+var image_checksum = null;  // Checksum of the image as last received (before any strokes were drawn on it)
+
+// Live sync strokes arrive several times a second, so the image is only stored once they stop.
+// (If the app is closed before then, the rows they were drawn on are sent again with the next image)
+var STORE_DELAY = 2000;
+var store_timer = null;
+
+// Image being received (compressed data is put in place by each chunk's offset)
+var receive_buffer = null;
+var received_length = 0;
+
+// Decode one row of image data compressed by the watch into pixels at pos, returning the position
+// after it in the data. Each row is either 0x80 (same as the row above) or PackBits tokens: 
+// 0x00-0x7F copy the next n+1 bytes, 0x81-0xFF repeat the next byte 257-n times
+function decodeRow(data, p, pixels, pos) {
+  var i;
+  
+  if (data[p] == 0x80) {
+    // Repeat of the previous row
+    for (i = 0; i < IMG_ROW_BYTES; i++) pixels[pos + i] = pixels[pos - IMG_ROW_BYTES + i];
+    return p + 1;
+  }
+  
+  var end = pos + IMG_ROW_BYTES;
+  while (pos < end && p < data.length) {
+    var token = data[p++];
+    if (token < 0x80) {
+      // Literal bytes
+      for (i = token + 1; i > 0; i--) pixels[pos++] = data[p++];
+    } else {
+      // Run of the same byte
+      var value = data[p++];
+      for (i = 257 - token; i > 0; i--) pixels[pos++] = value;
+    }
+  }
+  
+  return p;
+}
+
+// Decode a whole compressed image
+function decodeRLE(data) {
+  var pixels = new Uint8Array(IMG_PIXELS);
+  var p = 0;
+  
+  for (var y = 0; y < IMG_HEIGHT && p < data.length; y++) {
+    p = decodeRow(data, p, pixels, y * IMG_ROW_BYTES);
+  }
+  
+  return pixels;
+}
 
-// Convert value to 4 Byte charater
-function to4Byte(value) {
-  return String.fromCharCode(value&0xff, (value>>8)&0xff, (value>>16)&0xff, (value>>24)&0xff);
+// Patch ranges of compressed rows (each with a start row and row count) into the pixels
+function patchRows(data, pixels) {
+  var p = 0;
+  
+  while (p + 2 <= data.length) {
+    var start = data[p++];
+    var count = data[p++];
+    for (var y = start; y < start + count; y++) {
+      p = decodeRow(data, p, pixels, y * IMG_ROW_BYTES);
+    }
+  }
 }
 
-// Invert the Endianess of a byte value
-function swapByteEndianness(byte) { 
-  return ((byte & 0x1) << 7) | 
-          ((byte & 0x2) << 5) | 
-          ((byte & 0x4) << 3) | 
-          ((byte & 0x8) << 1) | 
-          ((byte >> 1) & 0x8) | 
-          ((byte >> 3) & 0x4) | 
-          ((byte >> 5) & 0x2) | 
-          ((byte >> 7) & 0x1); 
+// Adler-32 checksum of the pixels (matches the watch's checksum)
+function checksum(pixels) {
+  var a = 1, b = 0;
+  for (var i = 0; i < pixels.length; i++) {
+    a = (a + pixels[i]) % 65521;
+    b = (b + a) % 65521;
+  }
+  return ((b << 16) | a) >>> 0;
+}
+
+// Live sync strokes are a series of records:
+//  0xFF, flags, x, y: start a stroke at (x, y). Flags are the brush width in the low 5 bits, 
+//                     bit 6 for a round eraser and bit 7 for the eraser (else the pen)
+//  x, y:              draw from the last point to (x, y)
+var STROKE_START = 0xFF;
+var STROKE_ERASER = 0x80;
+var STROKE_ROUND = 0x40;
+var STROKE_WIDTH_MASK = 0x1F;
+
+var stroke_flags = null;  // Brush of the stroke being drawn (null until a stroke starts)
+var stroke_x = 0;         // Last point of the stroke
+var stroke_y = 0;
+
+// Integer square root rounded down
+function isqrt(n) {
+  var r = Math.floor(Math.sqrt(n));
+  while (r * r > n) r--;
+  while ((r + 1) * (r + 1) <= n) r++;
+  return r;
+}
+
+// Division rounded down/up (divisor must be positive)
+function divFloor(n, d) {
+  return Math.floor(n / d);
+}
+
+function divCeil(n, d) {
+  return -Math.floor(-n / d);
+}
+
+// Set (white) or clear (black) a horizontal run of pixels from x0 to x1 (inclusive)
+function drawSpan(pixels, x0, x1, y, white) {
+  if (y < 0 || y >= IMG_HEIGHT) return;
+  if (x0 < 0) x0 = 0;
+  if (x1 >= IMG_WIDTH) x1 = IMG_WIDTH - 1;
+  
+  for (var x = x0; x <= x1; x++) {
+    var i = (y * IMG_ROW_BYTES) + (x >> 3);
+    if (white)
+      pixels[i] |= 1 << (x & 7);
+    else
+      pixels[i] &= ~(1 << (x & 7));
+  }
+}
+
+// Draw a round or square brush centered on a point (same as the watch's brush stamps)
+function drawStamp(pixels, x, y, radius, round, white) {
+  for (var v = -radius; v <= radius; v++) {
+    var half = round ? isqrt((radius * radius) + radius - (v * v)) : radius;
+    drawSpan(pixels, x - half, x + half, y + v, white);
+  }
+}
+
+// Draw a thick black line with round ends (every pixel within radius + 1/2 of the line segment),
+// using the same integer math as the watch so the result is identical
+function drawCapsule(pixels, x0, y0, x1, y1, r) {
+  var dx = x1 - x0;
+  var dy = y1 - y0;
+  var len2 = (dx * dx) + (dy * dy);
+  var circle_limit = (r * r) + r;
+  var dist_limit = (len2 > 0) ? Math.floor(isqrt((2*r + 1) * (2*r + 1) * len2) / 2) : 0;
+  var top = Math.max(Math.min(y0, y1) - r, 0);
+  var bottom = Math.min(Math.max(y0, y1) + r, IMG_HEIGHT - 1);
+  
+  for (var y = top; y <= bottom; y++) {
+    var x_min = Infinity;
+    var x_max = -Infinity;
+    var v, half;
+    
+    // Spans of the round ends
+    v = y - y0;
+    if (v >= -r && v <= r) {
+      half = isqrt(circle_limit - (v * v));
+      x_min = Math.min(x_min, x0 - half);
+      x_max = Math.max(x_max, x0 + half);
+    }
+    v = y - y1;
+    if (v >= -r && v <= r) {
+      half = isqrt(circle_limit - (v * v));
+      x_min = Math.min(x_min, x1 - half);
+      x_max = Math.max(x_max, x1 + half);
+    }
+    
+    // Span of the line body
+    if (len2 > 0) {
+      v = y - y0;
+      var u_min = -Infinity;
+      var u_max = Infinity;
+      var cross = dx * v;
+      var along = dy * v;
+      
+      if (dy > 0) {
+        u_min = divCeil(cross - dist_limit, dy);
+        u_max = divFloor(cross + dist_limit, dy);
+      } else if (dy < 0) {
+        u_min = divCeil(-cross - dist_limit, -dy);
+        u_max = divFloor(-cross + dist_limit, -dy);
+      } else if (Math.abs(cross) > dist_limit) {
+        u_min = 1; u_max = 0;
+      }
+      
+      if (dx > 0) {
+        u_min = Math.max(u_min, divCeil(-along, dx));
+        u_max = Math.min(u_max, divFloor(len2 - along, dx));
+      } else if (dx < 0) {
+        u_min = Math.max(u_min, divCeil(along - len2, -dx));
+        u_max = Math.min(u_max, divFloor(along, -dx));
+      } else if (along < 0 || along > len2) {
+        u_min = 1; u_max = 0;
+      }
+      
+      if (u_min <= u_max) {
+        x_min = Math.min(x_min, x0 + u_min);
+        x_max = Math.max(x_max, x0 + u_max);
+      }
+    }
+    
+    if (x_min <= x_max) drawSpan(pixels, x_min, x_max, y, false);
+  }
+}
+
+// Draw the pen or eraser from one point to the next, the same way as the watch
+function drawSegment(pixels, flags, x0, y0, x1, y1) {
+  var radius = (flags & STROKE_WIDTH_MASK) >> 1;
+  
+  if (flags & STROKE_ERASER)
+    drawStamp(pixels, x1, y1, radius, (flags & STROKE_ROUND) !== 0, true);
+  else if (Math.abs(x1 - x0) > 1 || Math.abs(y1 - y0) > 1)
+    drawCapsule(pixels, x0, y0, x1, y1, radius);
+  else
+    drawStamp(pixels, x1, y1, radius, true, false);
+}
+
+// Draw a batch of stroke records onto the pixels, returning false if it carries on from a stroke
+// that wasn't received
+function drawStrokes(data, pixels) {
+  var p = 0;
+  
+  while (p + 2 <= data.length) {
+    if (data[p] == STROKE_START) {
+      if (p + 4 > data.length) break;
+      stroke_flags = data[p + 1];
+      stroke_x = data[p + 2];
+      stroke_y = data[p + 3];
+      p += 4;
+    } else {
+      if (stroke_flags === null) return false;
+      drawSegment(pixels, stroke_flags, stroke_x, stroke_y, data[p], data[p + 1]);
+      stroke_x = data[p];
+      stroke_y = data[p + 1];
+      p += 2;
+    }
+  }
+  
+  return true;
+}
+
+// Base64 lookup tables: every pair of characters for 12 bits, and the value of each character code
+var BASE64_PAIRS = [];
+var BASE64_VALUES = new Uint8Array(128);
+(function() {
+  for (var i = 0; i < 4096; i++) BASE64_PAIRS.push(BASE64_CHARS[i >> 6] + BASE64_CHARS[i & 63]);
+  for (var c = 0; c < BASE64_CHARS.length; c++) BASE64_VALUES[BASE64_CHARS.charCodeAt(c)] = c;
+})();
+
+// Encode bytes as base64
+function encodeBase64(bytes) {
+  var parts = [];
+  var i, n;
+  
+  for (i = 0; i + 2 < bytes.length; i += 3) {
+    n = (bytes[i] << 16) | (bytes[i + 1] << 8) | bytes[i + 2];
+    parts.push(BASE64_PAIRS[n >> 12] + BASE64_PAIRS[n & 4095]);
+  }
+  if (i < bytes.length) {
+    // 1 or 2 bytes left over
+    n = (bytes[i] << 16) | ((i + 1 < bytes.length) ? (bytes[i + 1] << 8) : 0);
+    parts.push(BASE64_PAIRS[n >> 12] + ((i + 1 < bytes.length) ? BASE64_CHARS[(n >> 6) & 63] : '=') + '=');
+  }
+  
+  return parts.join('');
+}
+
+// Decode base64 into bytes
+function decodeBase64(text) {
+  var len = text.length;
+  while (len > 0 && text[len - 1] == '=') len--;
+  var bytes = new Uint8Array(Math.floor(len * 3 / 4));
+  var p = 0;
+  
+  for (var i = 0; i < len; i += 4) {
+    var n = (BASE64_VALUES[text.charCodeAt(i)] << 18) | (BASE64_VALUES[text.charCodeAt(i + 1)] << 12) | 
+            (BASE64_VALUES[text.charCodeAt(i + 2) & 127] << 6) | BASE64_VALUES[text.charCodeAt(i + 3) & 127];
+    bytes[p++] = n >> 16;
+    if (p < bytes.length) bytes[p++] = (n >> 8) & 0xFF;
+    if (p < bytes.length) bytes[p++] = n & 0xFF;
+  }
+  
+  return bytes;
 }
 
-// Create a bitmap in string bytes from an array of 1-bit pixels
-function CreateBMP(pixel_data, width, height) {
-  var bmp;
- 
+// Save the image to local storage
+function storeImage() {
+  cancelStoreImage();
+  localStorage.imageData = STORAGE_VERSION + encodeBase64(image_data);
+}
+
+// Save the image to local storage once no more strokes have been drawn on it for a while
+function storeImageLater() {
+  cancelStoreImage();
+  store_timer = setTimeout(function() {
+    store_timer = null;
+    storeImage();
+  }, STORE_DELAY);
+}
+
+function cancelStoreImage() {
+  if (store_timer !== null) {
+    clearTimeout(store_timer);
+    store_timer = null;
+  }
+}
+
+// Read an image from local storage (null if there isn't one)
+function readImage(stored) {
+  if (stored.indexOf(STORAGE_VERSION) === 0)
+    return decodeBase64(stored.substring(STORAGE_VERSION.length));
+  
+  // Older versions stored a JSON array of bytes
+  var pixels = JSON.parse(stored);
+  return (pixels !== null && pixels.length == IMG_PIXELS) ? new Uint8Array(pixels) : null;
+}
+
+// Each byte value with its bits in reverse order (the watch has the leftmost pixel in the lowest
+// bit, image files have it in the highest)
+var REVERSED_BITS = new Uint8Array(256);
+(function() {
+  for (var i = 0; i < 256; i++) {
+    var r = 0;
+    for (var bit = 0; bit < 8; bit++) {
+      if (i & (1 << bit)) r |= 0x80 >> bit;
+    }
+    REVERSED_BITS[i] = r;
+  }
+})();
+
+// Write a 16 or 32-bit value into a byte array (little or big endian)
+function writeUint16LE(bytes, pos, value) {
+  bytes[pos] = value & 0xFF;
+  bytes[pos + 1] = (value >> 8) & 0xFF;
+}
+
+function writeUint32LE(bytes, pos, value) {
+  writeUint16LE(bytes, pos, value);
+  writeUint16LE(bytes, pos + 2, value >>> 16);
+}
+
+function writeUint32BE(bytes, pos, value) {
+  bytes[pos] = (value >>> 24) & 0xFF;
+  bytes[pos + 1] = (value >> 16) & 0xFF;
+  bytes[pos + 2] = (value >> 8) & 0xFF;
+  bytes[pos + 3] = value & 0xFF;
+}
+
+// Create a 1-bit bitmap file from the image pixels
+function createBMP(pixels) {
+  var BMP_HEADER_SIZE = 62;
+  var bmp = new Uint8Array(BMP_HEADER_SIZE + IMG_PIXELS);
+  
   // BMP Header
-  bmp = 'BM';                             // Bitmap ID
-  bmp += to4Byte(62 + pixel_data.length); // File size
-  bmp += to4Byte(0);                      // Unused
-  bmp += to4Byte(62);                     // Pixel offset
+  bmp[0] = 0x42;                                        // Bitmap ID 'BM'
+  bmp[1] = 0x4D;
+  writeUint32LE(bmp, 2, BMP_HEADER_SIZE + IMG_PIXELS);  // File size
+  writeUint32LE(bmp, 10, BMP_HEADER_SIZE);              // Pixel offset
   
   // DIB Header
-  bmp += to4Byte(40);                 // DIB header length
-  bmp += to4Byte(width);
-  bmp += to4Byte(height);
-  bmp += String.fromCharCode(1, 0);   // Single color pane
-  bmp += String.fromCharCode(1, 0);   // 1 bit per pixel
-  bmp += to4Byte(0);                  // No compression
-  bmp += to4Byte(pixel_data.length);
-  bmp += to4Byte(2835);               // Horizontal print resolution
-  bmp += to4Byte(2835);               // Vertical print resolution
-  bmp += to4Byte(0);                  // Color palette (black & white)
-  bmp += to4Byte(0);                  // All colors important
-  
-  // 1-bit B&W Palette
-  bmp += to4Byte(0);
-  bmp += to4Byte(16777215);
-  
-  // Reverse vertical order of pixel rows and swap byte endianness
-  var row_size = width / 8;
-  while (row_size % 4 !== 0) row_size++;  // Row size is always buffered to be a multiple of 4 (bytes)
-  
-  var pixels = [];
-  
-  for (var y = height-1; y >= 0; y--) {
-    for (var x = y * row_size; x < (y+1) * row_size; x++) {
-      pixels.push(swapByteEndianness(pixel_data[x]));
+  writeUint32LE(bmp, 14, 40);           // DIB header length
+  writeUint32LE(bmp, 18, IMG_WIDTH);
+  writeUint32LE(bmp, 22, IMG_HEIGHT);
+  writeUint16LE(bmp, 26, 1);            // Single color pane
+  writeUint16LE(bmp, 28, 1);            // 1 bit per pixel
+  writeUint32LE(bmp, 34, IMG_PIXELS);   // Pixel data size (no compression)
+  writeUint32LE(bmp, 38, 2835);         // Horizontal print resolution
+  writeUint32LE(bmp, 42, 2835);         // Vertical print resolution
+  
+  // 1-bit B&W Palette (black, then white)
+  writeUint32LE(bmp, 58, 0xFFFFFF);
+  
+  // Rows are bottom up (image rows are already padded to a multiple of 4 bytes)
+  var pos = BMP_HEADER_SIZE;
+  for (var y = IMG_HEIGHT - 1; y >= 0; y--) {
+    for (var i = y * IMG_ROW_BYTES; i < (y + 1) * IMG_ROW_BYTES; i++) {
+      bmp[pos++] = REVERSED_BITS[pixels[i]];
     }
   }
   
-  // Add the pixel data
-  bmp += String.fromCharCode.apply(String, pixels);
-  
   return bmp;
 }
 
-// Base64 encoder (since we don't have access to window.btoa)
-var Base64 = {
+// CRC-32 table for PNG chunks
+var CRC_TABLE = new Int32Array(256);
+(function() {
+  for (var n = 0; n < 256; n++) {
+    var c = n;
+    for (var k = 0; k < 8; k++) c = (c & 1) ? (0xEDB88320 ^ (c >>> 1)) : (c >>> 1);
+    CRC_TABLE[n] = c;
+  }
+})();
+
+function crc32(bytes, start, end) {
+  var c = -1;
+  for (var i = start; i < end; i++) c = CRC_TABLE[(c ^ bytes[i]) & 0xFF] ^ (c >>> 8);
+  return (c ^ -1) >>> 0;
+}
+
+// Deflate length and distance codes: first value of each code and its number of extra bits
+var LENGTH_BASE = [3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 
+                   67, 83, 99, 115, 131, 163, 195, 227, 258];
+var LENGTH_EXTRA = [0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0];
+var DIST_BASE = [1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 
+                 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577];
+var DIST_EXTRA = [0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13];
+var MIN_MATCH = 3;
+var MAX_MATCH = 258;
+var MAX_CHAIN = 32;  // Earlier matches tried at each position
 
-  // private property
-  _keyStr : "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/=",
+// Compress data into a single deflate block using the fixed Huffman codes, with matches found
+// through hash chains of 3 byte sequences (good enough for images this small)
+function deflate(data) {
+  var out = [];
+  var bit_buf = 0;
+  var bit_count = 0;
+  
+  // Write bits, first bit in the lowest bit
+  function putBits(value, count) {
+    bit_buf |= value << bit_count;
+    bit_count += count;
+    while (bit_count >= 8) {
+      out.push(bit_buf & 0xFF);
+      bit_buf >>>= 8;
+      bit_count -= 8;
+    }
+  }
   
-  // public method for encoding
-  encode : function (input) {
-      var output = "";
-      var chr1, chr2, chr3, enc1, enc2, enc3, enc4;
-      var i = 0;
+  // Write a Huffman code, which is stored from its highest bit
+  function putCode(code, count) {
+    var reversed = 0;
+    for (var i = 0; i < count; i++) reversed |= ((code >> i) & 1) << (count - 1 - i);
+    putBits(reversed, count);
+  }
   
-      while (i < input.length) {
+  // Write a literal/length symbol with its fixed Huffman code
+  function putSymbol(symbol) {
+    if (symbol < 144) putCode(0x30 + symbol, 8);
+    else if (symbol < 256) putCode(0x190 + symbol - 144, 9);
+    else if (symbol < 280) putCode(symbol - 256, 7);
+    else putCode(0xC0 + symbol - 280, 8);
+  }
   
-          chr1 = input.charCodeAt(i++);
-          chr2 = input.charCodeAt(i++);
-          chr3 = input.charCodeAt(i++);
+  function putMatch(length, distance) {
+    var code = 0;
+    while (code < LENGTH_BASE.length - 1 && LENGTH_BASE[code + 1] <= length) code++;
+    putSymbol(257 + code);
+    putBits(length - LENGTH_BASE[code], LENGTH_EXTRA[code]);
+    
+    code = 0;
+    while (code < DIST_BASE.length - 1 && DIST_BASE[code + 1] <= distance) code++;
+    putCode(code, 5);
+    putBits(distance - DIST_BASE[code], DIST_EXTRA[code]);
+  }
   
-          enc1 = chr1 >> 2;
-          enc2 = ((chr1 & 3) << 4) | (chr2 >> 4);
-          enc3 = ((chr2 & 15) << 2) | (chr3 >> 6);
-          enc4 = chr3 & 63;
+  var head = {};
+  var prev = new Int32Array(data.length);
   
-          if (isNaN(chr2)) {
-              enc3 = enc4 = 64;
-          } else if (isNaN(chr3)) {
-              enc4 = 64;
-          }
+  function insert(pos) {
+    var key = (data[pos] << 16) | (data[pos + 1] << 8) | data[pos + 2];
+    prev[pos] = (head[key] !== undefined) ? head[key] : -1;
+    head[key] = pos;
+  }
   
-          output = output +
-          this._keyStr.charAt(enc1) + this._keyStr.charAt(enc2) +
-          this._keyStr.charAt(enc3) + this._keyStr.charAt(enc4);
+  putBits(1, 1);  // Last block
+  putBits(1, 2);  // Fixed Huffman codes
   
+  var pos = 0;
+  while (pos < data.length) {
+    var best_len = 0;
+    var best_dist = 0;
+    
+    if (pos + MIN_MATCH <= data.length) {
+      var key = (data[pos] << 16) | (data[pos + 1] << 8) | data[pos + 2];
+      var max_len = Math.min(MAX_MATCH, data.length - pos);
+      var candidate = (head[key] !== undefined) ? head[key] : -1;
+      
+      for (var chain = 0; candidate >= 0 && chain < MAX_CHAIN; chain++) {
+        var len = 0;
+        while (len < max_len && data[candidate + len] == data[pos + len]) len++;
+        if (len > best_len) {
+          best_len = len;
+          best_dist = pos - candidate;
+          if (len == max_len) break;
+        }
+        candidate = prev[candidate];
+      }
+    }
+    
+    if (best_len >= MIN_MATCH) {
+      putMatch(best_len, best_dist);
+      for (var end = pos + best_len; pos < end; pos++) {
+        if (pos + MIN_MATCH <= data.length) insert(pos);
       }
+    } else {
+      putSymbol(data[pos]);
+      if (pos + MIN_MATCH <= data.length) insert(pos);
+      pos++;
+    }
+  }
+  
+  putSymbol(256);  // End of block
+  if (bit_count > 0) out.push(bit_buf & 0xFF);
+  
+  return out;
+}
+
+// Create a 1-bit grayscale PNG file from the image pixels
+function createPNG(pixels) {
+  var PNG_ROW_BYTES = IMG_WIDTH / 8;
   
-      return output;
+  // Rows each start with a filter type (0 = none)
+  var raw = new Uint8Array(IMG_HEIGHT * (PNG_ROW_BYTES + 1));
+  var pos = 0;
+  for (var y = 0; y < IMG_HEIGHT; y++) {
+    raw[pos++] = 0;
+    for (var i = y * IMG_ROW_BYTES; i < (y * IMG_ROW_BYTES) + PNG_ROW_BYTES; i++) {
+      raw[pos++] = REVERSED_BITS[pixels[i]];
+    }
+  }
+  
+  // zlib stream: header, deflate data, Adler-32 of the uncompressed data
+  var compressed = deflate(raw);
+  var idat = [0x78, 0x01].concat(compressed);
+  var adler = checksum(raw);
+  idat.push((adler >>> 24) & 0xFF, (adler >> 16) & 0xFF, (adler >> 8) & 0xFF, adler & 0xFF);
+  
+  var png = new Uint8Array(8 + (12 + 13) + (12 + idat.length) + 12);
+  png.set([0x89, 0x50, 0x4E, 0x47, 0x0D, 0x0A, 0x1A, 0x0A]);
+  pos = 8;
+  
+  // Add a chunk (length, type, data, CRC of type and data)
+  function putChunk(type, data) {
+    writeUint32BE(png, pos, data.length);
+    for (var i = 0; i < 4; i++) png[pos + 4 + i] = type.charCodeAt(i);
+    png.set(data, pos + 8);
+    writeUint32BE(png, pos + 8 + data.length, crc32(png, pos + 4, pos + 8 + data.length));
+    pos += 12 + data.length;
   }
-};
+  
+  var ihdr = new Uint8Array(13);
+  writeUint32BE(ihdr, 0, IMG_WIDTH);
+  writeUint32BE(ihdr, 4, IMG_HEIGHT);
+  ihdr[8] = 1;  // 1 bit per pixel, grayscale (color type 0), no interlace
+  
+  putChunk('IHDR', ihdr);
+  putChunk('IDAT', idat);
+  putChunk('IEND', []);
+  
+  return png;
+}
+
+// Image file shown in the settings page, kept with a copy of the image it was made from
+var image_file_cache = {pixels: null, type: null, base64: null};
+
+// Indicates if two images have the same pixels (checksums alone can match for different images)
+function samePixels(a, b) {
+  if (a === null || b === null || a.length != b.length) return false;
+  for (var i = 0; i < a.length; i++) {
+    if (a[i] != b[i]) return false;
+  }
+  return true;
+}
+
+// Get the image as a base64 file of the chosen type, only encoding it if the image has changed
+function getImageFile() {
+  if (!samePixels(image_file_cache.pixels, image_data) || image_file_cache.type !== IMAGE_FILE_TYPE) {
+    var file = (IMAGE_FILE_TYPE == 'png') ? createPNG(image_data) : createBMP(image_data);
+    image_file_cache = {pixels: new Uint8Array(image_data), type: IMAGE_FILE_TYPE, base64: encodeBase64(file)};
+    if (DEBUG) console.log("Encoded " + IMAGE_FILE_TYPE + " - " + file.length + " bytes");
+  }
+  
+  return image_file_cache.base64;
+}
 
 Pebble.addEventListener('ready',
   function(e) {
     if (DEBUG) console.log('JavaScript app ready and running!');
     // Read previous image from local storage if available
-    if (localStorage.imageData !== undefined) {
-      image_data = JSON.parse(localStorage.imageData);
+    if (localStorage.imageData !== undefined && localStorage.imageData !== null) {
+      image_data = readImage(localStorage.imageData);
     }
     if (localStorage.chunkStatus !== undefined) {
       chunk_status = parseInt(localStorage.chunkStatus);
     }
+    if (localStorage.imageChecksum !== undefined) {
+      image_checksum = parseInt(localStorage.imageChecksum);
+    }
   }
 );
 
@@ -123,35 +600,81 @@ Pebble.addEventListener("appmessage",
                         function(e) {
                           if (DEBUG) console.log("Pebble App Message!");
                           
+                          if (e.payload !== undefined && e.payload.stroke_data !== undefined) {
+                            // Live sync strokes, drawn on the last image received
+                            if (chunk_status != ChunkStatusEnum.LAST_CHUNK || image_data === null ||
+                                image_data.length != IMG_PIXELS ||
+                                !drawStrokes(e.payload.stroke_data, image_data)) {
+                              if (DEBUG) console.log('Strokes not drawn - asking for the whole image');
+                              Pebble.sendAppMessage({'resync': 1});
+                              return;
+                            }
+                            storeImageLater();
+                            return;
+                          }
+                          
                           if (e.payload !== undefined && e.payload.image_data !== undefined && 
-                              e.payload.chunk_status !== undefined) {
+                              e.payload.chunk_offset !== undefined && e.payload.image_length !== undefined) {
                             // Received image data chunk...
+                            var offset = e.payload.chunk_offset;
+                            var chunk = e.payload.image_data;
                             
                             if (DEBUG) {
                               console.log('Chunk status: ' + e.payload.chunk_status);
-                              console.log('Image data: ' + e.payload.image_data);
-                              console.log('Image data chunk length: ' + e.payload.image_data.length);
+                              console.log('Chunk offset: ' + offset + ' of ' + e.payload.image_length);
+                              console.log('Image data chunk length: ' + chunk.length);
+                            }
+                            
+                            if (offset === 0) {
+                              // Start of a new image. If only changed rows are being sent, they must be
+                              // changes to the image already stored, otherwise ask for the whole image.
+                              // (Live sync strokes may have been drawn on it since, but the rows
+                              // they were drawn on are always sent again)
+                              if (e.payload.base_checksum !== undefined && 
+                                  (chunk_status != ChunkStatusEnum.LAST_CHUNK || image_data === null ||
+                                   image_data.length != IMG_PIXELS ||
+                                   (image_checksum !== null ? image_checksum : checksum(image_data)) != 
+                                     (e.payload.base_checksum >>> 0))) {
+                                if (DEBUG) console.log('Stored image out of date - asking for the whole image');
+                                receive_buffer = null;
+                                Pebble.sendAppMessage({'resync': 1});
+                                return;
+                              }
+                              receive_buffer = new Uint8Array(e.payload.image_length);
+                              received_length = 0;
                             }
                             
-                            chunk_status = e.payload.chunk_status;
+                            // The watch resends from the last chunk acknowledged, so chunks may repeat
+                            // but never skip ahead
+                            if (receive_buffer === null || receive_buffer.length != e.payload.image_length ||
+                                offset > received_length || offset + chunk.length > receive_buffer.length) {
+                              if (DEBUG) console.log('Unexpected chunk - ignored');
+                              return;
+                            }
+                            receive_buffer.set(chunk, offset);
+                            received_length = Math.max(received_length, offset + chunk.length);
                             
-                            // Based on chunk location, reconstruct pixel data array
-                            switch (e.payload.chunk_status) {
-                              case ChunkStatusEnum.FIRST_CHUNK:
-                                // Start of pixel data
-                                image_data = e.payload.image_data;
-                                break;
-                              case ChunkStatusEnum.LAST_CHUNK:
-                                // Add last chunk to pixel array
-                                image_data = image_data.concat(e.payload.image_data);
-                                // Store pixel data in local storage as string
-                                localStorage.imageData = JSON.stringify(image_data);
-                                localStorage.chunkStatus = chunk_status;
-                                break;
-                              default:
-                                // Middle chunk - just add to pixel array
-                                image_data = image_data.concat(e.payload.image_data);
-                                break;
+                            if (received_length == receive_buffer.length) {
+                              // Got the whole image (or the changed rows), so decompress it if needed
+                              if (e.payload.image_format == ImageFormatEnum.ROWS) {
+                                if (e.payload.base_checksum === undefined) {
+                                  // Every row was sent
+                                  image_data = new Uint8Array(IMG_PIXELS);
+                                  for (var i = 0; i < IMG_PIXELS; i++) image_data[i] = 0xFF;
+                                }
+                                patchRows(receive_buffer, image_data);
+                              } else if (e.payload.image_format == ImageFormatEnum.RLE) {
+                                image_data = decodeRLE(receive_buffer);
+                              } else {
+                                image_data = new Uint8Array(receive_buffer);
+                              }
+                              receive_buffer = null;
+                              chunk_status = ChunkStatusEnum.LAST_CHUNK;
+                              image_checksum = checksum(image_data);
+                              // Store pixel data in local storage
+                              storeImage();
+                              localStorage.chunkStatus = chunk_status;
+                              localStorage.imageChecksum = image_checksum;
                             }
                           }
                         });
@@ -163,21 +686,20 @@ Pebble.addEventListener("showConfiguration",
                              console.log("Showing Settings...");
                            }
                            
-                           if (chunk_status == 3 && image_data.length > 1) {
-                             // Have valid image data, so generate the bitmap for showing in the Settings page
-                             var bmp = CreateBMP(image_data, 144, 168);
+                           if (chunk_status == 3 && image_data !== null && image_data.length > 1) {
+                             // Have valid image data, so generate the image file for showing in the Settings page
+                             var image_file = getImageFile();
                              
                              if (DEBUG) {
                                console.log("Image data length: " + image_data.length);
-                               console.log("BMP data length: " + bmp.length);
-                               console.log("Base64 BMP: " + Base64.encode(bmp));
+                               console.log("Base64 image: " + image_file);
                              }
                              
                              // Use Data URIs to render HTML and the bitmap in the HTML
                              Pebble.openURL("data:text/html," + 
-                                            encodeURIComponent('<html><head><meta name="viewport" content="width=device-width, initial-scale=1" /><script language="JavaScript">function CopyImg(e) {alert("Click OK and try pasting into something like a note or email.");}</script></head><body style="font-family: sans-serif;"><h1 style="text-align: center;">My Pebble Art</h1><p>iPhone users: Hold down on the image and tap Copy. Then create a new note in the Notes app and paste into the note. Tap Done and then hold down on the pasted image to save, copy, or send it from there.</p><p align="center" onCopy="CopyImg(event);"><img id="drawing" src="data:image/bmp;base64,' +
-                                                               Base64.encode(bmp) + '" width=144 height=168 style="width:50%; border: 2px black solid;" /></p><p>Alternatively select and copy the image as Base64 below and use a 3rd party tool to convert back to a BMP image.<br /><textarea id="txtBase64" style="width: 100%;" rows=4>' + 
-                                                               Base64.encode(bmp) + '</textarea><p style="text-align: center;"><input type="button" value="Close" style="font-size: larger;" onClick="location.href=&quot;pebblejs://close#&quot;" /> <input type="button" value="Clear" style="font-size: larger;" onClick="if (confirm(&apos;Are you sure you want to clear this?&apos;)) location.href=&quot;pebblejs://close#clear&quot;" /></p></body></html><!--.html'));
+                                            encodeURIComponent('<html><head><meta name="viewport" content="width=device-width, initial-scale=1" /><script language="JavaScript">function CopyImg(e) {alert("Click OK and try pasting into something like a note or email.");}</script></head><body style="font-family: sans-serif;"><h1 style="text-align: center;">My Pebble Art</h1><p>iPhone users: Hold down on the image and tap Copy. Then create a new note in the Notes app and paste into the note. Tap Done and then hold down on the pasted image to save, copy, or send it from there.</p><p align="center" onCopy="CopyImg(event);"><img id="drawing" src="data:image/' + IMAGE_FILE_TYPE + ';base64,' +
+                                                               image_file + '" width=144 height=168 style="width:50%; border: 2px black solid;" /></p><p>Alternatively select and copy the image as Base64 below and use a 3rd party tool to convert back to a ' + IMAGE_FILE_TYPE.toUpperCase() + ' image.<br /><textarea id="txtBase64" style="width: 100%;" rows=4>' + 
+                                                               image_file + '</textarea><p style="text-align: center;"><input type="button" value="Close" style="font-size: larger;" onClick="location.href=&quot;pebblejs://close#&quot;" /> <input type="button" value="Clear" style="font-size: larger;" onClick="if (confirm(&apos;Are you sure you want to clear this?&apos;)) location.href=&quot;pebblejs://close#clear&quot;" /></p></body></html><!--.html'));
                            }
                            else {
                              // No valid image data, so use data URL to generate HTML with instructions
@@ -196,8 +718,11 @@ Pebble.addEventListener("webviewclosed",
                                // Clear button clicked, so clear the variables and storage
                                image_data = null;
                                chunk_status = 0;
-                               localStorage.imageData = image_data;
+                               image_checksum = null;
+                               cancelStoreImage();
+                               localStorage.removeItem('imageData');
                                localStorage.chunkStatus = chunk_status;
+                               localStorage.removeItem('imageChecksum');
                              }
                            }
                            else {
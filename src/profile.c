@@ -0,0 +1,86 @@
+#include <pebble.h>
+#include "profile.h"
+#include "common.h"
+
+#ifdef DEBUG
+
+// Counts calls to the busiest parts of the app and how long they take (in ms, from time_ms), plus
+// how often the canvas falls behind the cursor. Everything is kept in fixed counters, so profiling
+// never allocates and costs two time_ms calls per section
+
+typedef struct {
+  uint32_t calls;
+  uint32_t total_ms;
+  uint16_t min_ms;
+  uint16_t max_ms;
+  uint32_t start;  // Time the current call started
+} ProfileCounter;
+
+static const char *s_names[PROFILE_SECTIONS] = { "Redraw", "Accel", "Save", "Send", "Init" };
+static ProfileCounter s_counters[PROFILE_SECTIONS];
+static bool s_frame_pending = false;
+static uint32_t s_frames_coalesced = 0;  // Redraws asked for while one was still waiting
+static uint32_t s_points_dropped = 0;    // Cursor points not drawn because the redraws fell behind
+
+void profile_start(ProfileSection section) {
+  s_counters[section].start = get_time_ms();
+  if (section == PROFILE_REDRAW) s_frame_pending = false;
+}
+
+void profile_end(ProfileSection section) {
+  ProfileCounter *counter = &s_counters[section];
+  uint32_t ms = get_time_ms() - counter->start;
+  if (ms > UINT16_MAX) ms = UINT16_MAX;
+  
+  if (counter->calls == 0 || ms < counter->min_ms) counter->min_ms = ms;
+  if (ms > counter->max_ms) counter->max_ms = ms;
+  counter->total_ms += ms;
+  counter->calls++;
+}
+
+// The canvas asked to be redrawn (if it is already waiting, the two frames become one)
+void profile_frame_requested(void) {
+  if (s_frame_pending) s_frames_coalesced++;
+  s_frame_pending = true;
+}
+
+void profile_point_dropped(void) {
+  s_points_dropped++;
+}
+
+// Format the average time of a section in tenths of a ms
+static void format_avg(char *text, size_t size, const ProfileCounter *counter) {
+  uint32_t tenths = (counter->calls > 0) ? (counter->total_ms * 10) / counter->calls : 0;
+  snprintf(text, size, "%d.%d", (int)(tenths / 10), (int)(tenths % 10));
+}
+
+// Write a summary of the counters, one line per section, for showing on the watch
+void profile_format(char *text, size_t size) {
+  char avg[12];
+  int len = snprintf(text, size, "ms: calls min/avg/max");
+  
+  for (int i = 0; i < PROFILE_SECTIONS && len < (int)size; i++) {
+    ProfileCounter *counter = &s_counters[i];
+    format_avg(avg, sizeof(avg), counter);
+    len += snprintf(text + len, size - len, "\n%s %d %d/%s/%d", s_names[i], (int)counter->calls,
+                    counter->min_ms, avg, counter->max_ms);
+  }
+  if (len < (int)size)
+    snprintf(text + len, size - len, "\nFrames merged: %d\nPoints dropped: %d", 
+             (int)s_frames_coalesced, (int)s_points_dropped);
+}
+
+void profile_log(void) {
+  char avg[12];
+  
+  for (int i = 0; i < PROFILE_SECTIONS; i++) {
+    ProfileCounter *counter = &s_counters[i];
+    format_avg(avg, sizeof(avg), counter);
+    APP_LOG(APP_LOG_LEVEL_DEBUG, "Profile %s - Calls: %d, Min: %d ms, Avg: %s ms, Max: %d ms, Total: %d ms", 
+            s_names[i], (int)counter->calls, counter->min_ms, avg, counter->max_ms, (int)counter->total_ms);
+  }
+  APP_LOG(APP_LOG_LEVEL_DEBUG, "Profile frames - Drawn: %d, Merged: %d, Points dropped: %d", 
+          (int)s_counters[PROFILE_REDRAW].calls, (int)s_frames_coalesced, (int)s_points_dropped);
+}
+
+#endif
@@ -0,0 +1,30 @@
+#pragma once
+#include <pebble.h>
+#include "common.h"
+
+// Code timed by the profiler
+typedef enum ProfileSection {
+  PROFILE_REDRAW = 0,      // Canvas redraw (updatecanvas)
+  PROFILE_ACCEL = 1,       // Accelerometer batch (accel_handler)
+  PROFILE_SAVE = 2,        // Saving the image (save_image)
+  PROFILE_SEND_CHUNK = 3,  // Sending a chunk of the image (send_image_chunk)
+  PROFILE_INIT = 4,        // App startup (init)
+  PROFILE_SECTIONS = 5
+} ProfileSection;
+
+// Profiling is only built into debug builds
+#ifdef DEBUG
+void profile_start(ProfileSection section);
+void profile_end(ProfileSection section);
+void profile_frame_requested(void);
+void profile_point_dropped(void);
+void profile_format(char *text, size_t size);
+void profile_log(void);
+#else
+#define profile_start(section)
+#define profile_end(section)
+#define profile_frame_requested()
+#define profile_point_dropped()
+#define profile_format(text, size)
+#define profile_log()
+#endif
@@ -0,0 +1,174 @@
+#include <pebble.h>
+#include "raster.h"
+#include "common.h"
+#include "intmath.h"
+
+// Software rasterizer that draws pen lines (with round ends) and brush stamps straight into the
+// image pixel data instead of going through the graphics context and framebuffer.
+// Pixels are 1 bit each (1 = white, 0 = black) with the leftmost pixel in the lowest bit, so on the
+// little-endian watch each row is 5 32-bit words with pixel x at bit (x % 32) of word (x / 32)
+
+// Set (white) or clear (black) the masked pixels of an image word
+static inline void apply_mask(uint32_t *word, uint32_t mask, GColor color) {
+  if (color == GColorWhite)
+    *word |= mask;
+  else
+    *word &= ~mask;
+}
+
+// Draw a horizontal run of pixels from x0 to x1 (inclusive) using whole-word masks
+void raster_hline(uint8_t *image, int16_t x0, int16_t x1, int16_t y, GColor color) {
+  // Clip to the image
+  if (y < 0 || y >= IMG_HEIGHT) return;
+  if (x0 < 0) x0 = 0;
+  if (x1 >= IMG_WIDTH) x1 = IMG_WIDTH - 1;
+  if (x1 < x0) return;
+  
+  uint32_t *row = (uint32_t *)(image + (y * IMG_ROW_BYTES));
+  int16_t first_word = x0 >> 5;
+  int16_t last_word = x1 >> 5;
+  uint32_t first_mask = UINT32_MAX << (x0 & 31);
+  uint32_t last_mask = UINT32_MAX >> (31 - (x1 & 31));
+  
+  if (first_word == last_word) {
+    apply_mask(&row[first_word], first_mask & last_mask, color);
+  } else {
+    apply_mask(&row[first_word], first_mask, color);
+    for (int16_t w = first_word + 1; w < last_word; w++)
+      apply_mask(&row[w], UINT32_MAX, color);
+    apply_mask(&row[last_word], last_mask, color);
+  }
+}
+
+// Draw a precomputed brush stamp centered on a point. Each stamp row is shifted into place
+// and applied to at most 2 image words
+void raster_stamp(uint8_t *image, const BrushStamp *stamp, GPoint center, GColor color) {
+  int16_t left = center.x - (stamp->size / 2);
+  int16_t top = center.y - (stamp->size / 2);
+  
+  // Clip stamp columns to the image
+  uint32_t clip = (1 << stamp->size) - 1;
+  if (left < 0) {
+    if (-left >= stamp->size) return;
+    clip &= clip << -left;
+  }
+  if (left + stamp->size > IMG_WIDTH) {
+    if (left >= IMG_WIDTH) return;
+    clip &= (1 << (IMG_WIDTH - left)) - 1;
+  }
+  
+  // Position of the stamp's first column in the image words (negative lefts shift right)
+  int16_t word = (left < 0) ? 0 : (left >> 5);
+  int16_t shift = (left < 0) ? 0 : (left & 31);
+  
+  for (int16_t r = 0; r < stamp->size; r++) {
+    int16_t y = top + r;
+    if (y < 0 || y >= IMG_HEIGHT) continue;
+    
+    uint32_t mask = stamp->rows[r] & clip;
+    if (left < 0) mask >>= -left;
+    if (mask == 0) continue;
+    
+    uint32_t *row = (uint32_t *)(image + (y * IMG_ROW_BYTES));
+    apply_mask(&row[word], mask << shift, color);
+    if (shift > 0 && (mask >> (32 - shift)) != 0)
+      apply_mask(&row[word + 1], mask >> (32 - shift), color);
+  }
+}
+
+// Fill a rectangle one row span at a time
+void raster_fill_rect(uint8_t *image, GRect rect, GColor color) {
+  for (int16_t y = rect.origin.y; y < rect.origin.y + rect.size.h; y++)
+    raster_hline(image, rect.origin.x, rect.origin.x + rect.size.w - 1, y, color);
+}
+
+// Division rounded down/up (divisor must be positive)
+static inline int32_t div_floor(int32_t n, int32_t d) {
+  return (n >= 0) ? (n / d) : -((-n + d - 1) / d);
+}
+
+static inline int32_t div_ceil(int32_t n, int32_t d) {
+  return -div_floor(-n, d);
+}
+
+// Draw a thick line with round ends (every pixel within radius + 1/2 of the line segment).
+// The shape is convex, so each row is a single span: the union of the spans of the two end
+// circles and of the straight body of the line, which is found by solving the distance and
+// end limits for x. Uses exact integer math so diagonal lines are as thick as straight ones
+void raster_draw_capsule(uint8_t *image, GPoint p0, GPoint p1, uint16_t radius, GColor color) {
+  int32_t dx = p1.x - p0.x;
+  int32_t dy = p1.y - p0.y;
+  int32_t len2 = (dx * dx) + (dy * dy);
+  int32_t r = radius;
+  int32_t circle_limit = (r * r) + r;
+  
+  // Line body: |dx*v - dy*u| <= (radius + 1/2) * length, where (u, v) is the offset from p0
+  int32_t dist_limit = (len2 > 0) ? (int32_t)(intsqrt_floor((2*r + 1) * (2*r + 1) * len2) / 2) : 0;
+  
+  int16_t top = (p0.y < p1.y ? p0.y : p1.y) - r;
+  int16_t bottom = (p0.y > p1.y ? p0.y : p1.y) + r;
+  if (top < 0) top = 0;
+  if (bottom >= IMG_HEIGHT) bottom = IMG_HEIGHT - 1;
+  
+  for (int16_t y = top; y <= bottom; y++) {
+    int32_t x_min = INT16_MAX;
+    int32_t x_max = INT16_MIN;
+    int32_t v, half;
+    
+    // Spans of the round ends
+    v = y - p0.y;
+    if (v >= -r && v <= r) {
+      half = intsqrt_floor(circle_limit - (v * v));
+      if (p0.x - half < x_min) x_min = p0.x - half;
+      if (p0.x + half > x_max) x_max = p0.x + half;
+    }
+    v = y - p1.y;
+    if (v >= -r && v <= r) {
+      half = intsqrt_floor(circle_limit - (v * v));
+      if (p1.x - half < x_min) x_min = p1.x - half;
+      if (p1.x + half > x_max) x_max = p1.x + half;
+    }
+    
+    // Span of the line body
+    if (len2 > 0) {
+      v = y - p0.y;
+      int32_t u_min = INT16_MIN;
+      int32_t u_max = INT16_MAX;
+      int32_t cross = dx * v;
+      int32_t along = dy * v;
+      
+      // Within distance of the line: cross - limit <= dy*u <= cross + limit
+      if (dy > 0) {
+        u_min = div_ceil(cross - dist_limit, dy);
+        u_max = div_floor(cross + dist_limit, dy);
+      } else if (dy < 0) {
+        u_min = div_ceil(-cross - dist_limit, -dy);
+        u_max = div_floor(-cross + dist_limit, -dy);
+      } else if (abs(cross) > dist_limit) {
+        u_min = 1; u_max = 0;
+      }
+      
+      // Between the ends: -dy*v <= dx*u <= len2 - dy*v
+      if (dx > 0) {
+        int32_t lo = div_ceil(-along, dx);
+        int32_t hi = div_floor(len2 - along, dx);
+        if (lo > u_min) u_min = lo;
+        if (hi < u_max) u_max = hi;
+      } else if (dx < 0) {
+        int32_t lo = div_ceil(along - len2, -dx);
+        int32_t hi = div_floor(along, -dx);
+        if (lo > u_min) u_min = lo;
+        if (hi < u_max) u_max = hi;
+      } else if (along < 0 || along > len2) {
+        u_min = 1; u_max = 0;
+      }
+      
+      if (u_min <= u_max) {
+        if (p0.x + u_min < x_min) x_min = p0.x + u_min;
+        if (p0.x + u_max > x_max) x_max = p0.x + u_max;
+      }
+    }
+    
+    if (x_min <= x_max) raster_hline(image, x_min, x_max, y, color);
+  }
+}
@@ -0,0 +1,10 @@
+#pragma once
+#include <pebble.h>
+#include "stamps.h"
+
+// Software rasterizer for drawing directly into 1-bit image data (IMG_ROW_BYTES per row)
+  
+void raster_hline(uint8_t *image, int16_t x0, int16_t x1, int16_t y, GColor color);
+void raster_stamp(uint8_t *image, const BrushStamp *stamp, GPoint center, GColor color);
+void raster_fill_rect(uint8_t *image, GRect rect, GColor color);
+void raster_draw_capsule(uint8_t *image, GPoint p0, GPoint p1, uint16_t radius, GColor color);
@@ -1,6 +1,8 @@
 #include <pebble.h>
 #include "settings.h"
 #include "common.h"
+#include "diagwin.h"
+#include "heap.h"
 
 // Application settings window, using a simple menu layer
 
@@ -11,11 +13,18 @@
 #define MAX_ERASER_WIDTH 15
   
 #define NUM_MENU_SECTIONS 2
-#define NUM_MENU_ACTION_ITEMS 2
-#define NUM_MENU_MISC_ITEMS 6
+#ifdef DEBUG
+#define NUM_MENU_ACTION_ITEMS 5
+#else
+#define NUM_MENU_ACTION_ITEMS 4
+#endif
+#define NUM_MENU_MISC_ITEMS 10
 #define MENU_ACTION_SECTION 0
 #define MENU_SEND_ITEM 0
 #define MENU_CLEAR_ITEM 1
+#define MENU_GALLERY_ITEM 2
+#define MENU_HELP_ITEM 3
+#define MENU_DIAGNOSTICS_ITEM 4  // Debug builds only
 #define MENU_MISC_SECTION 1
 #define MENU_PENWIDTH_ITEM 0
 #define MENU_DRAWINGCURSOR_ITEM 1
@@ -23,17 +32,23 @@
 #define MENU_SENSITIVTY_ITEM 3
 #define MENU_ERASERWIDTH_ITEM 4
 #define MENU_SECONDSHAKE_ITEM 5
+#define MENU_ERASERSHAPE_ITEM 6
+#define MENU_SMOOTHING_ITEM 7
+#define MENU_PATH_ITEM 8
+#define MENU_LIVESYNC_ITEM 9
   
 static struct Settings_st *s_settings; // Settings struct passed from main unit
 static SendToPhoneCallBack s_send_event;
 static ClearImageCallBack s_clear_event;
+static GalleryCallBack s_gallery_event;
+static HelpCallBack s_help_event;
 static SettingsClosedCallBack s_settings_closed;
 
 static Window *s_window;
 static MenuLayer *settings_layer;
 
 static void initialise_ui(void) {
-  s_window = window_create();
+  s_window = heap_window_create();
   window_set_fullscreen(s_window, false);
   
   // settings_layer
@@ -43,7 +58,7 @@ static void initialise_ui(void) {
 }
 
 static void destroy_ui(void) {
-  window_destroy(s_window);
+  heap_window_destroy(s_window);
   menu_layer_destroy(settings_layer);
   // Let main unit know settings window has been closed
   if (s_settings_closed != NULL) s_settings_closed();
@@ -107,6 +122,20 @@ static void menu_draw_row_callback(GContext* ctx, const Layer *cell_layer, MenuI
           // Option for clearing image
           menu_cell_basic_draw(ctx, cell_layer, "Clear Image", NULL, NULL);
           break;
+        case MENU_GALLERY_ITEM:
+          // Option for switching between saved drawings
+          menu_cell_basic_draw(ctx, cell_layer, "Drawings", NULL, NULL);
+          break;
+        case MENU_HELP_ITEM:
+          // Option for showing what each button does
+          menu_cell_basic_draw(ctx, cell_layer, "Button Help", NULL, NULL);
+          break;
+#ifdef DEBUG
+        case MENU_DIAGNOSTICS_ITEM:
+          // Show the profiler counters
+          menu_cell_basic_draw(ctx, cell_layer, "Diagnostics", "Timings & frames", NULL);
+          break;
+#endif
       }
       break;
     
@@ -163,6 +192,22 @@ static void menu_draw_row_callback(GContext* ctx, const Layer *cell_layer, MenuI
             menu_cell_basic_draw(ctx, cell_layer, "Second Shake", "Undo the last undo", NULL);
         
           break;
+        case MENU_ERASERSHAPE_ITEM:
+          // Show eraser brush shape
+          menu_cell_basic_draw(ctx, cell_layer, "Eraser Shape", s_settings->eraser_round ? "Round" : "Square", NULL);
+          break;
+        case MENU_SMOOTHING_ITEM:
+          // Show cursor smoothing type
+          menu_cell_basic_draw(ctx, cell_layer, "Smoothing", s_settings->adaptive_smoothing ? "Adaptive" : "Fixed", NULL);
+          break;
+        case MENU_PATH_ITEM:
+          // Show whether lines follow every accelerometer sample or the average of each batch
+          menu_cell_basic_draw(ctx, cell_layer, "Line Detail", s_settings->every_sample ? "Every sample" : "Averaged", NULL);
+          break;
+        case MENU_LIVESYNC_ITEM:
+          // Show whether drawing is sent to the phone as it is drawn
+          menu_cell_basic_draw(ctx, cell_layer, "Live Sync", s_settings->live_sync ? "Send while drawing" : "Off", NULL);
+          break;
       }
       break;
   }
@@ -183,6 +228,22 @@ static void menu_select_callback(MenuLayer *menu_layer, MenuIndex *cell_index, v
           if (s_clear_event != NULL) s_clear_event();
           hide_settings();
           break;
+        case MENU_GALLERY_ITEM:
+          // Call event in main unit to show the drawing gallery
+          if (s_gallery_event != NULL) s_gallery_event();
+          hide_settings();
+          break;
+        case MENU_HELP_ITEM:
+          // Call event in main unit to show the button help
+          if (s_help_event != NULL) s_help_event();
+          hide_settings();
+          break;
+#ifdef DEBUG
+        case MENU_DIAGNOSTICS_ITEM:
+          // Show the profiler counters over the settings
+          show_diagwin();
+          break;
+#endif
       }
       break;
     case MENU_MISC_SECTION:
@@ -216,6 +277,22 @@ static void menu_select_callback(MenuLayer *menu_layer, MenuIndex *cell_index, v
         case MENU_SECONDSHAKE_ITEM:
           s_settings->secondshake_clear = !s_settings->secondshake_clear;
           break;
+        case MENU_ERASERSHAPE_ITEM:
+          // Toggle eraser between square and round
+          s_settings->eraser_round = !s_settings->eraser_round;
+          break;
+        case MENU_SMOOTHING_ITEM:
+          // Toggle between fixed and adaptive (less smoothing when moving fast) cursor smoothing
+          s_settings->adaptive_smoothing = !s_settings->adaptive_smoothing;
+          break;
+        case MENU_PATH_ITEM:
+          // Toggle between drawing through every accelerometer sample (5x the detail) or batch averages
+          s_settings->every_sample = !s_settings->every_sample;
+          break;
+        case MENU_LIVESYNC_ITEM:
+          // Toggle sending strokes to the phone as they are drawn
+          s_settings->live_sync = !s_settings->live_sync;
+          break;
       }
       layer_mark_dirty(menu_layer_get_layer(settings_layer));
       break;
@@ -228,7 +305,7 @@ static void handle_window_unload(Window* window) {
 }
 
 // Show settings window with settings passed as reference to structure and with callback procedures
-void show_settings(struct Settings_st *settings, SendToPhoneCallBack send_event, ClearImageCallBack clear_event, SettingsClosedCallBack settings_closed) {
+void show_settings(struct Settings_st *settings, SendToPhoneCallBack send_event, ClearImageCallBack clear_event, GalleryCallBack gallery_event, HelpCallBack help_event, SettingsClosedCallBack settings_closed) {
   initialise_ui();
   window_set_window_handlers(s_window, (WindowHandlers) {
     .unload = handle_window_unload,
@@ -237,6 +314,8 @@ void show_settings(struct Settings_st *settings, SendToPhoneCallBack send_event,
   s_settings = settings;
   s_send_event = send_event;
   s_clear_event = clear_event;
+  s_gallery_event = gallery_event;
+  s_help_event = help_event;
   s_settings_closed = settings_closed;
   
   // Set all the callbacks for the menu layer
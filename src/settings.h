@@ -4,6 +4,8 @@
 typedef void (*SettingsClosedCallBack)();
 typedef void (*SendToPhoneCallBack)();
 typedef void (*ClearImageCallBack)();
+typedef void (*GalleryCallBack)();
+typedef void (*HelpCallBack)();
 
 typedef enum CursorSensitivity {
   CS_LOW = 1,
@@ -17,8 +19,12 @@ struct Settings_st {
   CursorSensitivity sensitivity;
   bool secondshake_clear;
   int eraser_width;
+  bool eraser_round;
+  bool adaptive_smoothing;
+  bool every_sample;
   int pen_width;
+  bool live_sync;
 };
 
-void show_settings(struct Settings_st *settings, SendToPhoneCallBack send_event, ClearImageCallBack clear_event, SettingsClosedCallBack settings_closed);
+void show_settings(struct Settings_st *settings, SendToPhoneCallBack send_event, ClearImageCallBack clear_event, GalleryCallBack gallery_event, HelpCallBack help_event, SettingsClosedCallBack settings_closed);
 void hide_settings(void);
\ No newline at end of file
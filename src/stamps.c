@@ -0,0 +1,66 @@
+#include <pebble.h>
+#include "stamps.h"
+
+// Brush stamp tables for every (odd) pen and eraser width, so drawing at a point never has to
+// work out the brush shape. Each row is a bit pattern with bit 0 as the leftmost pixel.
+// Round brushes cover the pixels within width/2 + 1/2 of the center (same as the pen line ends)
+
+#define NUM_STAMPS 8  // Widths 1, 3, 5 ... 15
+
+static const uint16_t s_round_1[] = { 0x0001 };
+static const uint16_t s_round_3[] = { 0x0007, 0x0007, 0x0007 };
+static const uint16_t s_round_5[] = { 0x000E, 0x001F, 0x001F, 0x001F, 0x000E };
+static const uint16_t s_round_7[] = { 0x001C, 0x003E, 0x007F, 0x007F, 0x007F, 0x003E, 0x001C };
+static const uint16_t s_round_9[] = { 0x007C, 0x00FE, 0x01FF, 0x01FF, 0x01FF, 0x01FF, 0x01FF, 0x00FE, 0x007C };
+static const uint16_t s_round_11[] = { 0x00F8, 0x01FC, 0x03FE, 0x07FF, 0x07FF, 0x07FF, 0x07FF, 0x07FF, 0x03FE, 0x01FC, 0x00F8 };
+static const uint16_t s_round_13[] = { 0x01F0, 0x07FC, 0x0FFE, 0x0FFE, 0x1FFF, 0x1FFF, 0x1FFF, 0x1FFF, 0x1FFF, 0x0FFE, 0x0FFE, 0x07FC, 0x01F0 };
+static const uint16_t s_round_15[] = { 0x03E0, 0x0FF8, 0x1FFC, 0x3FFE, 0x3FFE, 0x7FFF, 0x7FFF, 0x7FFF, 0x7FFF, 0x7FFF, 0x3FFE, 0x3FFE, 0x1FFC, 0x0FF8, 0x03E0 };
+
+static const uint16_t s_square_1[] = { 0x0001 };
+static const uint16_t s_square_3[] = { 0x0007, 0x0007, 0x0007 };
+static const uint16_t s_square_5[] = { 0x001F, 0x001F, 0x001F, 0x001F, 0x001F };
+static const uint16_t s_square_7[] = { 0x007F, 0x007F, 0x007F, 0x007F, 0x007F, 0x007F, 0x007F };
+static const uint16_t s_square_9[] = { 0x01FF, 0x01FF, 0x01FF, 0x01FF, 0x01FF, 0x01FF, 0x01FF, 0x01FF, 0x01FF };
+static const uint16_t s_square_11[] = { 0x07FF, 0x07FF, 0x07FF, 0x07FF, 0x07FF, 0x07FF, 0x07FF, 0x07FF, 0x07FF, 0x07FF, 0x07FF };
+static const uint16_t s_square_13[] = { 0x1FFF, 0x1FFF, 0x1FFF, 0x1FFF, 0x1FFF, 0x1FFF, 0x1FFF, 0x1FFF, 0x1FFF, 0x1FFF, 0x1FFF, 0x1FFF, 0x1FFF };
+static const uint16_t s_square_15[] = { 0x7FFF, 0x7FFF, 0x7FFF, 0x7FFF, 0x7FFF, 0x7FFF, 0x7FFF, 0x7FFF, 0x7FFF, 0x7FFF, 0x7FFF, 0x7FFF, 0x7FFF, 0x7FFF, 0x7FFF };
+
+static const BrushStamp s_round_stamps[NUM_STAMPS] = {
+  { 1, s_round_1 },
+  { 3, s_round_3 },
+  { 5, s_round_5 },
+  { 7, s_round_7 },
+  { 9, s_round_9 },
+  { 11, s_round_11 },
+  { 13, s_round_13 },
+  { 15, s_round_15 }
+};
+
+static const BrushStamp s_square_stamps[NUM_STAMPS] = {
+  { 1, s_square_1 },
+  { 3, s_square_3 },
+  { 5, s_square_5 },
+  { 7, s_square_7 },
+  { 9, s_square_9 },
+  { 11, s_square_11 },
+  { 13, s_square_13 },
+  { 15, s_square_15 }
+};
+
+// Table index for a width (even widths use the next smaller odd width)
+static int stamp_index(int width) {
+  int index = (width - 1) / 2;
+  if (index < 0) return 0;
+  if (index >= NUM_STAMPS) return NUM_STAMPS - 1;
+  return index;
+}
+
+// Gets the round brush stamp for a pen/eraser width
+const BrushStamp *get_round_stamp(int width) {
+  return &s_round_stamps[stamp_index(width)];
+}
+
+// Gets the square brush stamp for an eraser width
+const BrushStamp *get_square_stamp(int width) {
+  return &s_square_stamps[stamp_index(width)];
+}
\ No newline at end of file
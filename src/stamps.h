@@ -0,0 +1,11 @@
+#pragma once
+#include <pebble.h>
+
+// Precomputed brush shape for a pen/eraser width (size x size pixels, one bit pattern per row)
+typedef struct {
+  uint8_t size;
+  const uint16_t *rows;
+} BrushStamp;
+
+const BrushStamp *get_round_stamp(int width);
+const BrushStamp *get_square_stamp(int width);
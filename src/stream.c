@@ -0,0 +1,147 @@
+#include <pebble.h>
+#include "stream.h"
+#include "common.h"
+
+// Queue of the line segments drawn on the canvas, so they can be sent to the phone in batches and
+// drawn there too (live sync). Adding a segment is just a few byte copies, so drawing is never held
+// up by sending. If the queue fills up (e.g. the phone is slow or gone) the queued segments are
+// dropped and the phone is sent the changed image rows instead.
+//
+// Records in the queue:
+//  0xFF, flags, x, y: start a stroke at (x, y) without drawing. Flags are the brush width in the
+//                     low 5 bits, bit 6 for a round eraser and bit 7 for the eraser (else the pen)
+//  x, y:              draw a segment from the last point to (x, y) (x is always < 0xFF)
+
+#define STREAM_QUEUE_SIZE 256
+#define STROKE_START 0xFF
+#define STROKE_START_SIZE 4
+#define STROKE_POINT_SIZE 2
+#define FLAG_ERASER 0x80
+#define FLAG_ROUND 0x40
+#define FLAG_WIDTH_MASK 0x1F
+
+static bool s_enabled = false;
+static uint8_t s_queue[STREAM_QUEUE_SIZE];
+static uint16_t s_queue_len = 0;
+static StreamResync s_resync = STREAM_RESYNC_NONE;
+static uint8_t s_flags;         // Brush of the last queued record
+static GPoint s_last;           // End of the last queued record
+static bool s_have_last = false;
+static uint8_t s_drawn_rows[DIRTY_ROW_BYTES];  // Rows drawn on since the phone was last sent the image
+
+// Turn live sync on or off. The phone needs to catch up with the image first after turning it on
+void stream_set_enabled(bool enabled) {
+  if (enabled && !s_enabled) stream_resync();
+  s_enabled = enabled;
+  if (!enabled) {
+    s_queue_len = 0;
+    s_have_last = false;
+  }
+}
+
+bool stream_is_enabled(void) {
+  return s_enabled;
+}
+
+// Mark the rows a segment draws on, so they are sent if the phone has to catch up later
+static void mark_drawn_rows(GPoint from, GPoint to, uint8_t width) {
+  int top = (from.y < to.y ? from.y : to.y) - (width / 2) - 1;
+  int bottom = (from.y > to.y ? from.y : to.y) + (width / 2) + 1;
+  if (top < 0) top = 0;
+  if (bottom >= IMG_HEIGHT) bottom = IMG_HEIGHT - 1;
+  
+  for (int y = top; y <= bottom; y++) {
+    s_drawn_rows[y / 8] |= 1 << (y % 8);
+  }
+}
+
+// Drop everything queued and have the phone sent the image instead
+static void overflow(void) {
+  APP_LOG(APP_LOG_LEVEL_DEBUG, "Stroke queue full - phone will be resynced");
+  stream_strokes_lost();
+}
+
+// Queue a segment drawn from one point to another (called for every segment the canvas draws)
+void stream_segment(GPoint from, GPoint to, bool eraser, bool round, uint8_t width) {
+  if (!s_enabled) return;
+  
+  mark_drawn_rows(from, to, width);
+  
+  // Until the phone starts catching up, the rows it is sent will include this segment anyway
+  if (s_resync != STREAM_RESYNC_NONE) return;
+  
+  uint8_t flags = (width & FLAG_WIDTH_MASK) | (eraser ? FLAG_ERASER : 0) | (eraser && round ? FLAG_ROUND : 0);
+  
+  // Start a new stroke if the brush changed or the segment doesn't carry on from the last one
+  if (!s_have_last || flags != s_flags || from.x != s_last.x || from.y != s_last.y) {
+    if (s_queue_len + STROKE_START_SIZE + STROKE_POINT_SIZE > STREAM_QUEUE_SIZE) {
+      overflow();
+      return;
+    }
+    s_queue[s_queue_len++] = STROKE_START;
+    s_queue[s_queue_len++] = flags;
+    s_queue[s_queue_len++] = from.x;
+    s_queue[s_queue_len++] = from.y;
+    s_flags = flags;
+  } else if (s_queue_len + STROKE_POINT_SIZE > STREAM_QUEUE_SIZE) {
+    overflow();
+    return;
+  }
+  
+  s_queue[s_queue_len++] = to.x;
+  s_queue[s_queue_len++] = to.y;
+  s_last = to;
+  s_have_last = true;
+}
+
+// The image changed in a way strokes can't describe (undo, clear, another drawing), so the phone
+// needs the changed rows
+void stream_resync(void) {
+  if (s_resync == STREAM_RESYNC_NONE) s_resync = STREAM_RESYNC_ROWS;
+  s_queue_len = 0;
+  s_have_last = false;
+}
+
+// Strokes queued or sent were lost, so the phone needs the whole image
+void stream_strokes_lost(void) {
+  s_resync = STREAM_RESYNC_FULL;
+  s_queue_len = 0;
+  s_have_last = false;
+}
+
+// What the phone needs to be sent to catch up
+StreamResync stream_resync_needed(void) {
+  return s_enabled ? s_resync : STREAM_RESYNC_NONE;
+}
+
+// Sending the image to the phone has started, so queue strokes again (they are drawn on the phone
+// after the image, which gives the same result even if the image already has them)
+void stream_resync_started(void) {
+  s_resync = STREAM_RESYNC_NONE;
+}
+
+// Move up to max bytes of whole records from the queue, returning the bytes moved
+uint16_t stream_take(uint8_t *dest, uint16_t max) {
+  uint16_t len = 0;
+  
+  while (len < s_queue_len) {
+    uint16_t size = (s_queue[len] == STROKE_START) ? STROKE_START_SIZE : STROKE_POINT_SIZE;
+    if (len + size > max) break;
+    len += size;
+  }
+  
+  memcpy(dest, s_queue, len);
+  s_queue_len -= len;
+  memmove(s_queue, s_queue + len, s_queue_len);
+  return len;
+}
+
+// Indicates if a row was drawn on since the phone was last sent the image
+bool stream_is_row_drawn(int y) {
+  return (s_drawn_rows[y / 8] & (1 << (y % 8))) != 0;
+}
+
+// The phone has been sent the image
+void stream_clear_drawn_rows(void) {
+  memset(s_drawn_rows, 0, sizeof(s_drawn_rows));
+}
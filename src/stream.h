@@ -0,0 +1,19 @@
+#pragma once
+#include <pebble.h>
+
+typedef enum StreamResync {
+  STREAM_RESYNC_NONE = 0,
+  STREAM_RESYNC_ROWS = 1,  // Phone needs the rows that changed or were drawn on
+  STREAM_RESYNC_FULL = 2   // Strokes were lost, so the phone needs the whole image
+} StreamResync;
+
+void stream_set_enabled(bool enabled);
+bool stream_is_enabled(void);
+void stream_segment(GPoint from, GPoint to, bool eraser, bool round, uint8_t width);
+void stream_resync(void);
+StreamResync stream_resync_needed(void);
+void stream_resync_started(void);
+void stream_strokes_lost(void);
+uint16_t stream_take(uint8_t *dest, uint16_t max);
+bool stream_is_row_drawn(int y);
+void stream_clear_drawn_rows(void);
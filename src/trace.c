@@ -0,0 +1,113 @@
+#include <pebble.h>
+#include "trace.h"
+#include "common.h"
+
+#ifdef TRACE
+
+// Records raw accelerometer batches, button presses and settings changes, so a drawing session
+// can be replayed exactly on the host (host/replay.c). Records are collected in a small buffer
+// that is written to the log as hex each time it fills and when the app closes, so a whole
+// session can be captured from 'pebble logs'. Each log line is TRACE_LOG_MARKER, a line number
+// (to spot lines the log dropped) and up to TRACE_LINE_BYTES bytes of records.
+//
+// Records (multi-byte values are little-endian, times are ms since the previous record):
+//  1, count, vibrate mask, time (2):  accelerometer batch, followed by count samples of
+//                                     x, y, z (2 each), ms since the previous sample (1)
+//  2, event, value, time (2):         button press, tap or focus change (see TraceEvent)
+//  3, flags, pen width, eraser width, max tilt (2), time (2):  settings (see TRACE_* flags)
+
+#define TRACE_BUFFER_SIZE 512
+#define TRACE_LINE_BYTES 32
+
+static uint8_t s_buffer[TRACE_BUFFER_SIZE];
+static uint16_t s_length = 0;
+static uint16_t s_line = 0;
+static uint32_t s_last_time;
+
+// Write the buffered records to the log
+void trace_flush(void) {
+  static const char hex[] = "0123456789abcdef";
+  char text[(TRACE_LINE_BYTES * 2) + 1];
+  
+  for (int offset = 0; offset < s_length; offset += TRACE_LINE_BYTES) {
+    int len = (s_length - offset < TRACE_LINE_BYTES) ? (s_length - offset) : TRACE_LINE_BYTES;
+    for (int i = 0; i < len; i++) {
+      text[i * 2] = hex[s_buffer[offset + i] >> 4];
+      text[(i * 2) + 1] = hex[s_buffer[offset + i] & 0x0F];
+    }
+    text[len * 2] = '\0';
+    APP_LOG(APP_LOG_LEVEL_DEBUG, TRACE_LOG_MARKER " %03d %s", s_line, text);
+    s_line = (s_line + 1) % 1000;
+  }
+  s_length = 0;
+}
+
+// Make room for a record, returning where to write it
+static uint8_t *reserve(uint16_t size) {
+  if (s_length + size > TRACE_BUFFER_SIZE) trace_flush();
+  uint8_t *record = &s_buffer[s_length];
+  s_length += size;
+  return record;
+}
+
+static void put16(uint8_t *dest, uint16_t value) {
+  dest[0] = value & 0xFF;
+  dest[1] = value >> 8;
+}
+
+// Time since the last record (saturated to 16 bits)
+static uint16_t elapsed(uint32_t now) {
+  uint32_t ms = now - s_last_time;
+  s_last_time = now;
+  return (ms > UINT16_MAX) ? UINT16_MAX : ms;
+}
+
+void trace_start(void) {
+  s_length = 0;
+  s_line = 0;
+  s_last_time = get_time_ms();
+  APP_LOG(APP_LOG_LEVEL_DEBUG, TRACE_LOG_MARKER " start");
+}
+
+void trace_accel(AccelData *data, uint32_t num_samples) {
+  if (num_samples > 8) num_samples = 8;  // Vibrate mask has a bit per sample
+  
+  uint8_t *record = reserve(TRACE_ACCEL_HEADER_SIZE + (num_samples * TRACE_SAMPLE_SIZE));
+  uint8_t vibrate_mask = 0;
+  record[0] = TRACE_RECORD_ACCEL;
+  record[1] = num_samples;
+  put16(&record[3], (num_samples > 0) ? elapsed((uint32_t)data[0].timestamp) : 0);
+  
+  uint8_t *sample = &record[TRACE_ACCEL_HEADER_SIZE];
+  for (uint32_t i = 0; i < num_samples; i++) {
+    if (data[i].did_vibrate) vibrate_mask |= 1 << i;
+    put16(&sample[0], data[i].x);
+    put16(&sample[2], data[i].y);
+    put16(&sample[4], data[i].z);
+    uint32_t gap = (i > 0) ? (uint32_t)(data[i].timestamp - data[i - 1].timestamp) : 0;
+    sample[6] = (gap > UINT8_MAX) ? UINT8_MAX : gap;
+    sample += TRACE_SAMPLE_SIZE;
+  }
+  record[2] = vibrate_mask;
+  if (num_samples > 0) s_last_time = (uint32_t)data[num_samples - 1].timestamp;
+}
+
+void trace_event(TraceEvent event, uint8_t value) {
+  uint8_t *record = reserve(TRACE_EVENT_SIZE);
+  record[0] = TRACE_RECORD_EVENT;
+  record[1] = event;
+  record[2] = value;
+  put16(&record[3], elapsed(get_time_ms()));
+}
+
+void trace_config(uint16_t max_tilt, uint8_t flags, uint8_t pen_width, uint8_t eraser_width) {
+  uint8_t *record = reserve(TRACE_CONFIG_SIZE);
+  record[0] = TRACE_RECORD_CONFIG;
+  record[1] = flags;
+  record[2] = pen_width;
+  record[3] = eraser_width;
+  put16(&record[4], max_tilt);
+  put16(&record[6], elapsed(get_time_ms()));
+}
+
+#endif
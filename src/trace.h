@@ -0,0 +1,47 @@
+#pragma once
+#include <pebble.h>
+#include "common.h"
+
+// Record types in a trace (see trace.c for the layout of each)
+typedef enum TraceRecordType {
+  TRACE_RECORD_ACCEL = 1,
+  TRACE_RECORD_EVENT = 2,
+  TRACE_RECORD_CONFIG = 3
+} TraceRecordType;
+
+typedef enum TraceEvent {
+  TRACE_UP_CLICK = 1,
+  TRACE_SELECT_CLICK = 2,
+  TRACE_SELECT_HOLD = 3,
+  TRACE_DOWN_CLICK = 4,
+  TRACE_TAP = 5,          // Value is the axis
+  TRACE_FOCUS = 6,        // Value is 1 for in focus
+  TRACE_RECENTER = 7      // Cursor recentered (e.g. the info window closed)
+} TraceEvent;
+
+// Settings flags in a config record
+#define TRACE_EVERY_SAMPLE 0x01
+#define TRACE_ADAPTIVE 0x02
+#define TRACE_ERASER_ROUND 0x04
+#define TRACE_SECONDSHAKE_CLEAR 0x08
+#define TRACE_DRAWING_CURSOR 0x10
+
+#define TRACE_ACCEL_HEADER_SIZE 5
+#define TRACE_SAMPLE_SIZE 7
+#define TRACE_EVENT_SIZE 5
+#define TRACE_CONFIG_SIZE 8
+#define TRACE_LOG_MARKER "TRACE"
+
+#ifdef TRACE
+void trace_start(void);
+void trace_accel(AccelData *data, uint32_t num_samples);
+void trace_event(TraceEvent event, uint8_t value);
+void trace_config(uint16_t max_tilt, uint8_t flags, uint8_t pen_width, uint8_t eraser_width);
+void trace_flush(void);
+#else
+#define trace_start()
+#define trace_accel(data, num_samples)
+#define trace_event(event, value)
+#define trace_config(max_tilt, flags, pen_width, eraser_width)
+#define trace_flush()
+#endif
@@ -0,0 +1,107 @@
+#include <pebble.h>
+#include "tracking.h"
+#include "common.h"
+#include "intmath.h"
+#include "filter.h"
+
+// Turns batches of accelerometer samples into cursor locations, based on the tilt of the watch
+// from where it was held when the cursor was last centered
+
+// Variables for cursor centering
+static bool s_centered = false;
+static uint16_t s_center_x;
+static uint16_t s_center_y;
+
+// Filters for smoothing acceleromter values
+static AxisFilter s_filter_x;
+static AxisFilter s_filter_y;
+static AxisFilter s_filter_z;
+
+static int s_max_tilt;
+static bool s_every_sample = false;
+
+// Set the tilt for moving the cursor from the center to the edge, and whether the cursor moves
+// through every sample or to the average of each batch
+void tracking_configure(int max_tilt, bool every_sample) {
+  s_max_tilt = max_tilt;
+  s_every_sample = every_sample;
+}
+
+// Use the next batch of samples as the new center
+void tracking_recenter(void) {
+  s_centered = false;
+}
+
+// Filter accel values and convert them to a cursor location
+static GPoint filtered_loc(int x, int y, int z) {
+  // Accel values are a little erratic, so use a (fixed-point) low-pass filter to smooth them out
+  int filtered_x = filter_update(&s_filter_x, x);
+  int filtered_y = filter_update(&s_filter_y, y);
+  int filtered_z = filter_update(&s_filter_z, z);
+  
+  // Convert filtered accel values to a cursor location based on the tilt from the center
+  return tilt_to_cursor(filtered_x, filtered_y, filtered_z, s_center_x, s_center_y, s_max_tilt, GSize(IMG_WIDTH, IMG_HEIGHT));
+}
+
+// Process a batch of accelerometer samples, returning the number of cursor locations put in the
+// path to move the cursor through (0 if the batch was used to center the cursor or is invalid)
+uint8_t tracking_process(AccelData *data, uint32_t num_samples, GPoint *path, uint8_t max_points) {
+  int total_x = 0;
+  int total_y = 0;
+  int total_z = 0;
+  int avg_x = 0;
+  int avg_y = 0;
+  int avg_z = 0;
+  
+  if (num_samples == 0 || max_points == 0) return 0;
+  
+  // Calculate totals in order to average accel in each axis for the sample size
+  for (int i = 0; i < (int)num_samples; i++) {
+    // Samples taken while vibrating are no good
+    if (data[i].did_vibrate) return 0;
+    total_x += data[i].x;
+    total_y += -data[i].y;
+    total_z += data[i].z;
+  }
+  
+  avg_x = divide(total_x, num_samples);
+  avg_y = divide(total_y, num_samples);
+  avg_z = divide(total_z, num_samples);
+  
+  if (s_centered) {
+    // If cursor center has been fixed, move cursor as necessary
+    // (The 'pen down' setting will determine if anything is drawn)
+    
+    if (s_every_sample) {
+      // Move the cursor through every sample's location, drawing the whole path in one redraw
+      uint8_t count = 0;
+      
+      for (int i = 0; i < (int)num_samples && count < max_points; i++)
+        path[count++] = filtered_loc(data[i].x, -data[i].y, data[i].z);
+      
+      return count;
+    } else {
+      // Move the cursor to the sample average location
+      path[0] = filtered_loc(avg_x, avg_y, avg_z);
+      return 1;
+    }
+    
+  } else {
+    // Use this sample average as the center location for calculating change for moving the cursor
+    
+    // Convert accel values to angles in the x and y plane
+    uint16_t angle_x, angle_y;
+    tilt_to_angles(avg_x, avg_y, avg_z, &angle_x, &angle_y);
+    
+    s_center_x = angle_x;
+    s_center_y = angle_y;
+    filter_reset(&s_filter_x, avg_x);
+    filter_reset(&s_filter_y, avg_y);
+    filter_reset(&s_filter_z, avg_z);
+    s_centered = true;
+    
+    APP_LOG(APP_LOG_LEVEL_DEBUG, "Baselines - x: %d g, x: %d deg, y: %d g, y: %d deg, z %d g", 
+            avg_x, (int)divide(360 * angle_x, UINT16_MAX), avg_y, (int)divide(360 * angle_y, UINT16_MAX), avg_z);
+    return 0;
+  }
+}
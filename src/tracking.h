@@ -0,0 +1,15 @@
+#pragma once
+#include <pebble.h>
+
+// Tilt from the center for the cursor to reach the edge of the screen, by sensitivity setting
+#define HIGH_TILT UINT16_MAX / 14   // Approx. 25deg
+#define MEDIUM_TILT UINT16_MAX / 10 // Approx. 35deg
+#define LOW_TILT UINT16_MAX / 8     // 45deg
+  
+#define FILTER_TIME_CONSTANT 900  // Accelerometer smoothing time constant in ms (Higher = smoother, slower. Lower = faster, less smooth)
+#define ACCEL_BATCH_SIZE 5        // Accelerometer samples per batch (at 50Hz)
+#define ACCEL_BATCH_PERIOD 100    // Time between accelerometer batches in ms
+
+void tracking_configure(int max_tilt, bool every_sample);
+void tracking_recenter(void);
+uint8_t tracking_process(AccelData *data, uint32_t num_samples, GPoint *path, uint8_t max_points);
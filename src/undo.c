@@ -0,0 +1,220 @@
+#include <pebble.h>
+#include "undo.h"
+#include "common.h"
+#include "heap.h"
+
+// Multi-level undo history. Each drawing/erasing session is stored as the difference (XOR) between
+// the image before and after the session, run-length encoded since most bytes don't change.
+// Applying an entry's XOR to the image undoes it, and applying it again redoes it, so undo and redo
+// work in place without any extra full image copies.
+// A session that changes too much to fit in the history is kept as a raw XOR of the whole image
+// instead, in the copy of the image from the start of the session (at most one such level, so
+// at most one extra image copy is kept between sessions)
+
+#define UNDO_HISTORY_SIZE 2048  // Bytes for all entries (less than one 3360 byte image copy)
+#define MAX_UNDO_LEVELS 16
+
+// Encoded entries are a series of tokens:
+//  0x00 - 0x7F: skip (token + 1) unchanged bytes
+//  0x80 - 0xFF: XOR the next ((token & 0x7F) + 1) bytes of the entry into the image
+#define TOKEN_LITERAL 0x80
+#define MAX_RUN 128
+
+static uint8_t s_history[UNDO_HISTORY_SIZE];  // Entries, oldest first
+static uint16_t s_entry_len[MAX_UNDO_LEVELS];
+static uint8_t s_count = 0;  // Number of entries stored
+static uint8_t s_pos = 0;    // Number of entries applied to the image (entries after this can be redone)
+static uint16_t s_used = 0;  // Bytes used by stored entries
+static GBitmap *s_raw = NULL; // Whole image XOR of the entry stored with length 0 (if any)
+
+// Encode the difference between two images (or just calculate its size if dest is NULL)
+static uint16_t encode_delta(const uint8_t *before, const uint8_t *after, uint8_t *dest) {
+  uint16_t len = 0;
+  int i = 0;
+  
+  while (i < IMG_PIXELS) {
+    // Run of unchanged bytes
+    int run = 0;
+    while (i + run < IMG_PIXELS && run < MAX_RUN && before[i + run] == after[i + run]) run++;
+    
+    if (run > 0) {
+      // Unchanged bytes at the end don't need storing
+      if (i + run >= IMG_PIXELS) break;
+      if (dest != NULL) dest[len] = run - 1;
+      len++;
+      i += run;
+      continue;
+    }
+    
+    // Run of changed bytes
+    while (i + run < IMG_PIXELS && run < MAX_RUN && before[i + run] != after[i + run]) run++;
+    
+    if (dest != NULL) {
+      dest[len] = TOKEN_LITERAL | (run - 1);
+      for (int k = 0; k < run; k++)
+        dest[len + 1 + k] = before[i + k] ^ after[i + k];
+    }
+    len += run + 1;
+    i += run;
+  }
+  
+  return len;
+}
+
+// XOR the raw entry into the image, returning the rows changed
+static GRect apply_raw(uint8_t *image) {
+  const uint8_t *delta = s_raw->addr;
+  int first = -1;
+  int last = 0;
+  
+  for (int i = 0; i < IMG_PIXELS; i++) {
+    if (delta[i] == 0) continue;
+    image[i] ^= delta[i];
+    if (first < 0) first = i;
+    last = i;
+  }
+  
+  if (first < 0) return GRect(0, 0, 0, 0);
+  
+  int16_t top = first / IMG_ROW_BYTES;
+  return GRect(0, top, IMG_WIDTH, (last / IMG_ROW_BYTES) - top + 1);
+}
+
+// XOR an encoded entry into the image, returning the rows changed (as a full width rectangle)
+static GRect apply_delta(const uint8_t *delta, uint16_t len, uint8_t *image) {
+  if (len == 0) return apply_raw(image);
+  
+  uint16_t p = 0;
+  int i = 0;
+  int first = -1;
+  int last = 0;
+  
+  while (p < len && i < IMG_PIXELS) {
+    uint8_t token = delta[p++];
+    
+    if (token & TOKEN_LITERAL) {
+      if (first < 0) first = i;
+      for (int k = (token & ~TOKEN_LITERAL) + 1; k > 0 && i < IMG_PIXELS; k--)
+        image[i++] ^= delta[p++];
+      last = i - 1;
+    } else {
+      i += token + 1;
+    }
+  }
+  
+  if (first < 0) return GRect(0, 0, 0, 0);
+  
+  int16_t top = first / IMG_ROW_BYTES;
+  return GRect(0, top, IMG_WIDTH, (last / IMG_ROW_BYTES) - top + 1);
+}
+
+// Position of an entry in the history buffer
+static uint16_t entry_start(uint8_t index) {
+  uint16_t start = 0;
+  for (uint8_t e = 0; e < index; e++)
+    start += s_entry_len[e];
+  return start;
+}
+
+// Free the raw entry if it is no longer one of the first count entries
+static void release_raw(uint8_t count) {
+  if (s_raw == NULL) return;
+  for (uint8_t e = 0; e < count; e++) {
+    if (s_entry_len[e] == 0) return;
+  }
+  heap_bitmap_destroy(s_raw);
+  s_raw = NULL;
+}
+
+// Remove the oldest entry to make room for a new one
+static void drop_oldest(void) {
+  uint16_t len = s_entry_len[0];
+  
+  memmove(s_history, s_history + len, s_used - len);
+  memmove(s_entry_len, s_entry_len + 1, (s_count - 1) * sizeof(s_entry_len[0]));
+  s_used -= len;
+  s_count--;
+  if (s_pos > 0) s_pos--;
+  release_raw(s_count);
+}
+
+// Add the changes made to an image since the copy 'before' was taken as the latest undo level.
+// Takes over the copy (it is either freed or kept as the level's raw XOR)
+void undo_push(GBitmap *before, const uint8_t *after) {
+  if (before == NULL) return;
+  
+  // A new change replaces anything that could have been redone
+  s_count = s_pos;
+  s_used = entry_start(s_count);
+  release_raw(s_count);
+  
+  uint16_t len = encode_delta(before->addr, after, NULL);
+  
+  // Nothing changed, so nothing to undo
+  if (len == 0) {
+    heap_bitmap_destroy(before);
+    return;
+  }
+  
+  if (len > UNDO_HISTORY_SIZE) {
+    // Too many changes to encode, so keep the XOR of the whole image (replacing any older raw
+    // level, along with the levels before it, which can't be reached without it)
+    APP_LOG(APP_LOG_LEVEL_DEBUG, "Undo entry too large: %d bytes - keeping whole image", len);
+    while (s_raw != NULL) drop_oldest();
+    while (s_count >= MAX_UNDO_LEVELS) drop_oldest();
+    
+    uint8_t *delta = before->addr;
+    for (int i = 0; i < IMG_PIXELS; i++)
+      delta[i] ^= after[i];
+    s_raw = before;
+    len = 0;
+  } else {
+    while (s_count >= MAX_UNDO_LEVELS || s_used + len > UNDO_HISTORY_SIZE)
+      drop_oldest();
+    
+    encode_delta(before->addr, after, s_history + s_used);
+    heap_bitmap_destroy(before);
+  }
+  
+  s_entry_len[s_count] = len;
+  s_count++;
+  s_pos = s_count;
+  s_used += len;
+  
+  APP_LOG(APP_LOG_LEVEL_DEBUG, "Undo levels: %d, bytes used: %d", s_count, s_used);
+}
+
+// Indicates if there are changes that can be undone
+bool undo_can_undo(void) {
+  return (s_pos > 0);
+}
+
+// Indicates if there are undone changes that can be redone
+bool undo_can_redo(void) {
+  return (s_pos < s_count);
+}
+
+// Roll back the image by one undo level, returning the area changed
+GRect undo_step_back(uint8_t *image) {
+  if (!undo_can_undo()) return GRect(0, 0, 0, 0);
+  
+  s_pos--;
+  return apply_delta(s_history + entry_start(s_pos), s_entry_len[s_pos], image);
+}
+
+// Re-apply the last undone level to the image, returning the area changed
+GRect undo_step_forward(uint8_t *image) {
+  if (!undo_can_redo()) return GRect(0, 0, 0, 0);
+  
+  GRect changed = apply_delta(s_history + entry_start(s_pos), s_entry_len[s_pos], image);
+  s_pos++;
+  return changed;
+}
+
+// Discard all undo levels
+void undo_reset(void) {
+  s_count = 0;
+  s_pos = 0;
+  s_used = 0;
+  release_raw(0);
+}
@@ -0,0 +1,9 @@
+#pragma once
+#include <pebble.h>
+
+void undo_push(GBitmap *before, const uint8_t *after);
+bool undo_can_undo(void);
+bool undo_can_redo(void);
+GRect undo_step_back(uint8_t *image);
+GRect undo_step_forward(uint8_t *image);
+void undo_reset(void);